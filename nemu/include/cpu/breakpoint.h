@@ -0,0 +1,39 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_BREAKPOINT_H__
+#define __CPU_BREAKPOINT_H__
+
+#include <common.h>
+
+/* Breakpoints are set in sdb (src/monitor/sdb/breakpoint.c). Their pcs
+ * are never held by the decode cache and always start a new block, so
+ * that the table is only looked up on decode cache misses and at the
+ * entries of blocks.
+ */
+#ifndef CONFIG_TARGET_AM
+extern int bp_nr; // number of breakpoints
+
+bool bp_find(vaddr_t pc);
+void bp_hit(vaddr_t pc);
+
+static inline bool bp_at(vaddr_t pc) {
+  return unlikely(bp_nr > 0) && bp_find(pc);
+}
+#else
+static inline bool bp_at(vaddr_t pc) { return false; }
+#endif
+
+#endif
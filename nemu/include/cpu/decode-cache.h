@@ -0,0 +1,92 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __CPU_DECODE_CACHE_H__
+#define __CPU_DECODE_CACHE_H__
+
+#include <common.h>
+
+/* A direct-mapped cache of decoding results, indexed by pc.
+ * An entry remembers the execute body of the matched pattern together with
+ * the already decoded operands, so that a hit can skip instruction fetching,
+ * pattern matching and operand decoding.
+ */
+typedef struct DecodeCacheEntry {
+  vaddr_t pc;         // tag
+  uint32_t inst;      // raw instruction, used by itrace
+  const void *exec;   // execute body of the matched pattern
+  uint8_t rd, rs1, rs2;
+  word_t imm;
+} DecodeCacheEntry;
+
+#define DECODE_CACHE_INVALID ((vaddr_t)-1)
+
+extern DecodeCacheEntry decode_cache[CONFIG_DECODE_CACHE_SIZE];
+extern uint32_t decode_cache_code[];
+extern uint64_t decode_cache_hit, decode_cache_miss;
+
+static inline DecodeCacheEntry* decode_cache_lookup(vaddr_t pc) {
+  return &decode_cache[(pc >> 2) & (CONFIG_DECODE_CACHE_SIZE - 1)];
+}
+
+void decode_cache_fill(DecodeCacheEntry *e, vaddr_t pc, uint32_t inst,
+    const void *exec, int rd, int rs1, int rs2, word_t imm);
+// mark the instruction word at `pc` as cached, stores to it are then tracked
+void decode_cache_mark(vaddr_t pc);
+void decode_cache_invalidate(paddr_t addr);
+void decode_cache_flush();
+void decode_cache_statistic();
+
+// translated blocks do not cross pages, and are invalidated by the page they are in
+#define TB_PAGE_SHIFT 12
+
+#ifdef CONFIG_ENGINE_THREADED
+#define TB_MAX_INST 32
+
+/* A translated basic block: the decoded instructions from `pc` up to the
+ * first control flow instruction, executed with threaded dispatch.
+ */
+typedef struct TBlock {
+  vaddr_t pc;         // tag
+  int ninst;
+  vaddr_t hot_pc;     // candidate block which is not translated yet
+  uint32_t nr_visit;
+  struct TBlock *page_next;  // next block indexed by the same page
+  DecodeCacheEntry inst[TB_MAX_INST];
+} TBlock;
+
+void tcache_invalidate(vaddr_t pc);
+void tcache_flush();
+#endif
+
+// whether the instruction word at `addr` may be held by the decode cache,
+// the last byte of a store may lie beyond pmem, which is never cached
+static inline bool decode_cache_is_code(paddr_t addr) {
+  paddr_t idx = (addr - CONFIG_MBASE) >> 2;
+  return idx < CONFIG_MSIZE / 4 && ((decode_cache_code[idx / 32] >> (idx % 32)) & 1);
+}
+
+/* Called on every store into pmem. Only stores to cached
+ * instructions pay for the invalidation.
+ */
+static inline void decode_cache_check_write(paddr_t addr, int len) {
+  paddr_t last = addr + len - 1;
+  if (unlikely(decode_cache_is_code(addr))) decode_cache_invalidate(addr);
+  if (unlikely(decode_cache_is_code(last))) decode_cache_invalidate(last);
+  IFDEF(CONFIG_ISA64, if (len == 8 && unlikely(decode_cache_is_code(addr + 4))) decode_cache_invalidate(addr + 4));
+}
+
+#endif
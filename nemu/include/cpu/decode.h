@@ -23,7 +23,6 @@ typedef struct Decode {
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
-  IFDEF(CONFIG_ITRACE, char logbuf[128]);
 } Decode;
 
 // --- pattern matching mechanism ---
@@ -86,17 +85,97 @@ finish:
 }
 
 
+// --- decode table built from the patterns ---
+/* The patterns between INSTPAT_START() and INSTPAT_END() are collected the
+ * first time the decoder runs. The bits which best tell the patterns apart
+ * are then used to index a table, each bucket of which lists the patterns
+ * that may match, in source order. A lookup only tries these few patterns
+ * instead of the whole chain.
+ */
+#define INSTPAT_TABLE_BITS 10
+
+typedef struct {
+  uint64_t key, mask;
+  const void *exec;    // the code of the matched pattern
+} InstPatEntry;
+
+typedef struct {
+  uint8_t lo, len, pos; // inst[lo + len - 1 : lo] goes to index[pos + len - 1 : pos]
+} InstPatField;
+
+typedef struct {
+  bool ready;
+  int nr_pat, max_pat;
+  InstPatEntry *pat;      // all patterns in source order
+  int nr_field;
+  InstPatField field[INSTPAT_TABLE_BITS];
+  InstPatEntry **bucket;  // candidates of each index, ended by an entry matching anything
+} InstPatTable;
+
+void instpat_table_add(InstPatTable *t, uint64_t key, uint64_t mask, const void *exec);
+void instpat_table_build(InstPatTable *t, const void *end);
+
+static inline const void* instpat_lookup(const InstPatTable *t, uint64_t inst) {
+  uint32_t idx = 0;
+  for (int i = 0; i < t->nr_field; i ++) {
+    const InstPatField *f = &t->field[i];
+    idx |= ((inst >> f->lo) & BITMASK(f->len)) << f->pos;
+  }
+  const InstPatEntry *p = t->bucket[idx];
+  while ((inst & p->mask) != p->key) p ++;
+  return p->exec;
+}
+
+// --- per-pattern statistics ---
+/* Each INSTPAT() gets an id from __COUNTER__ at compile time, so counting
+ * an executed instruction is a single increment in a flat array. The ISA
+ * puts INSTPAT_COUNT() in INSTPAT_MATCH() where its execute body starts.
+ */
+#ifdef CONFIG_INST_STAT
+#define NR_INSTPAT_ID 1024
+
+extern uint64_t instpat_count[NR_INSTPAT_ID];
+extern uint64_t inst_stat_jump; // instructions which do not fall through
+void instpat_stat_register(int id, const char *name);
+void inst_stat_display();
+
+#define INSTPAT_NAME(name, ...) #name
+#define INSTPAT_ID_DECL() \
+  enum { __instpat_id = __COUNTER__ }; \
+  static_assert(__instpat_id < NR_INSTPAT_ID, "too many patterns, enlarge NR_INSTPAT_ID");
+#define INSTPAT_COUNT() (instpat_count[__instpat_id] ++)
+#else
+#define INSTPAT_ID_DECL()
+#define INSTPAT_COUNT()
+#endif
+
 // --- pattern matching wrappers for decode ---
+#define INSTPAT_MATCH_LABEL concat(__instpat_match_, __LINE__)
+
 #define INSTPAT(pattern, ...) do { \
+  INSTPAT_ID_DECL() \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
-  if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+  if (unlikely(!__instpat_table.ready)) { \
+    instpat_table_add(&__instpat_table, key << shift, mask << shift, &&INSTPAT_MATCH_LABEL); \
+    IFDEF(CONFIG_INST_STAT, instpat_stat_register(__instpat_id, INSTPAT_NAME(__VA_ARGS__))); \
+  } else if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+INSTPAT_MATCH_LABEL: \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
 } while (0)
 
-#define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name);
-#define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
+#define INSTPAT_START(name) { \
+  static const void * const __instpat_end = &&concat(__instpat_end_, name); \
+  static InstPatTable __instpat_table = {}; \
+  if (likely(__instpat_table.ready)) goto *instpat_lookup(&__instpat_table, INSTPAT_INST(s));
+
+#define INSTPAT_END(name) \
+  if (unlikely(!__instpat_table.ready)) { \
+    instpat_table_build(&__instpat_table, __instpat_end); \
+    goto *instpat_lookup(&__instpat_table, INSTPAT_INST(s)); \
+  } \
+  concat(__instpat_end_, name): ; }
 
 #endif
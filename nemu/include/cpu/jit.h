@@ -0,0 +1,195 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_JIT_H__
+#define __CPU_JIT_H__
+
+#include <common.h>
+
+// --- x86-64 code emitter used by the dynamic binary translator ---
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+       CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+// opcodes of `op r/m32, r32`
+enum { X86_ADD = 0x01, X86_OR = 0x09, X86_AND = 0x21, X86_SUB = 0x29, X86_XOR = 0x31, X86_CMP = 0x39 };
+// opcode extensions of `op r/m32, imm32`
+enum { EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_SUB = 5, EXT_XOR = 6, EXT_CMP = 7 };
+// opcode extensions of shifts
+enum { EXT_SHL = 4, EXT_SHR = 5, EXT_SAR = 7 };
+
+/* Register convention inside translated code:
+ *   rbp:           &cpu
+ *   r15:           host address of pmem
+ *   r14:           remaining instruction budget
+ *   rbx, r12, r13: guest registers allocated by the translator
+ * All other registers are scratch.
+ */
+#define JIT_CPU    RBP
+#define JIT_MEM    R15
+#define JIT_BUDGET R14
+
+typedef struct JitCtx {
+  uint8_t *p;
+  uint8_t *end;
+} JitCtx;
+
+#define MODRM(mod, reg, rm) ((((mod) & 3) << 6) | (((reg) & 7) << 3) | ((rm) & 7))
+
+static inline void emit8(JitCtx *c, uint8_t v) { *c->p ++ = v; }
+static inline void emit32(JitCtx *c, uint32_t v) { memcpy(c->p, &v, 4); c->p += 4; }
+static inline void emit64(JitCtx *c, uint64_t v) { memcpy(c->p, &v, 8); c->p += 8; }
+
+static inline void x86_rex(JitCtx *c, bool w, int reg, int index, int base) {
+  uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+  if (rex != 0x40) emit8(c, rex);
+}
+
+// [base + disp32]
+static inline void x86_mem(JitCtx *c, int reg, int base, int32_t disp) {
+  emit8(c, MODRM(2, reg, base));
+  if ((base & 7) == RSP) emit8(c, 0x24);
+  emit32(c, disp);
+}
+
+// op r/m32, r32
+static inline void x86_op_rr(JitCtx *c, uint8_t op, int rm, int reg) {
+  x86_rex(c, 0, reg, 0, rm);
+  emit8(c, op);
+  emit8(c, MODRM(3, reg, rm));
+}
+
+static inline void x86_mov_rr(JitCtx *c, int dst, int src) { x86_op_rr(c, 0x89, dst, src); }
+
+static inline void x86_mov_ri(JitCtx *c, int dst, uint32_t imm) {
+  x86_rex(c, 0, 0, 0, dst);
+  emit8(c, 0xb8 + (dst & 7));
+  emit32(c, imm);
+}
+
+static inline void x86_movabs(JitCtx *c, int dst, uint64_t imm) {
+  x86_rex(c, 1, 0, 0, dst);
+  emit8(c, 0xb8 + (dst & 7));
+  emit64(c, imm);
+}
+
+static inline void x86_alu_ri(JitCtx *c, bool w, int ext, int dst, uint32_t imm) {
+  x86_rex(c, w, 0, 0, dst);
+  emit8(c, 0x81);
+  emit8(c, MODRM(3, ext, dst));
+  emit32(c, imm);
+}
+
+static inline void x86_shift_ri(JitCtx *c, int ext, int dst, uint8_t imm) {
+  x86_rex(c, 0, 0, 0, dst);
+  emit8(c, 0xc1);
+  emit8(c, MODRM(3, ext, dst));
+  emit8(c, imm);
+}
+
+// shift by cl
+static inline void x86_shift_rcl(JitCtx *c, int ext, int dst) {
+  x86_rex(c, 0, 0, 0, dst);
+  emit8(c, 0xd3);
+  emit8(c, MODRM(3, ext, dst));
+}
+
+// dst = (cc ? 1 : 0), dst should be one of eax, ecx, edx and ebx
+static inline void x86_setcc_zx(JitCtx *c, int cc, int dst) {
+  emit8(c, 0x0f); emit8(c, 0x90 + cc); emit8(c, MODRM(3, 0, dst));
+  emit8(c, 0x0f); emit8(c, 0xb6); emit8(c, MODRM(3, dst, dst));
+}
+
+// 32-bit or 64-bit load/store between a register and [base + disp32]
+static inline void x86_load(JitCtx *c, bool w, int dst, int base, int32_t disp) {
+  x86_rex(c, w, dst, 0, base);
+  emit8(c, 0x8b);
+  x86_mem(c, dst, base, disp);
+}
+
+static inline void x86_store(JitCtx *c, bool w, int base, int32_t disp, int src) {
+  x86_rex(c, w, src, 0, base);
+  emit8(c, 0x89);
+  x86_mem(c, src, base, disp);
+}
+
+/* Access [r15 + rcx] with `opcode` (one or two bytes, the high byte first),
+ * where `reg` is the register operand. This is used for guest memory accesses.
+ */
+static inline void x86_guest_mem(JitCtx *c, bool p66, uint16_t opcode, int reg) {
+  if (p66) emit8(c, 0x66);
+  x86_rex(c, 0, reg, RCX, JIT_MEM);
+  if (opcode > 0xff) emit8(c, opcode >> 8);
+  emit8(c, opcode & 0xff);
+  emit8(c, MODRM(0, reg, RSP));
+  emit8(c, ((RCX & 7) << 3) | (JIT_MEM & 7));
+}
+
+// bt dword [base], bitreg
+static inline void x86_bt_m(JitCtx *c, int base, int bitreg) {
+  x86_rex(c, 0, bitreg, 0, base);
+  emit8(c, 0x0f); emit8(c, 0xa3);
+  emit8(c, MODRM(0, bitreg, base));
+}
+
+static inline void x86_push(JitCtx *c, int r) { x86_rex(c, 0, 0, 0, r); emit8(c, 0x50 + (r & 7)); }
+static inline void x86_pop(JitCtx *c, int r) { x86_rex(c, 0, 0, 0, r); emit8(c, 0x58 + (r & 7)); }
+static inline void x86_ret(JitCtx *c) { emit8(c, 0xc3); }
+
+static inline void x86_jmp_r(JitCtx *c, int r) {
+  x86_rex(c, 0, 0, 0, r);
+  emit8(c, 0xff);
+  emit8(c, MODRM(3, 4, r));
+}
+
+// lea dst, [rip + (target - next_rip)]
+static inline void x86_lea_rip(JitCtx *c, int dst, void *target) {
+  x86_rex(c, 1, dst, 0, 0);
+  emit8(c, 0x8d);
+  emit8(c, MODRM(0, dst, 5));
+  emit32(c, (uint8_t *)target - (c->p + 4));
+}
+
+// branches return the address of their rel32 field, which is patched later
+static inline int32_t* x86_jcc(JitCtx *c, int cc) {
+  emit8(c, 0x0f); emit8(c, 0x80 + cc);
+  int32_t *rel = (int32_t *)c->p;
+  emit32(c, 0);
+  return rel;
+}
+
+static inline int32_t* x86_jmp(JitCtx *c) {
+  emit8(c, 0xe9);
+  int32_t *rel = (int32_t *)c->p;
+  emit32(c, 0);
+  return rel;
+}
+
+static inline void x86_patch(int32_t *rel, void *target) {
+  int32_t v = (uint8_t *)target - ((uint8_t *)rel + 4);
+  memcpy(rel, &v, 4);
+}
+
+// --- interface between the translator and the engine ---
+
+// exit translated code with the next pc known at translation time,
+// the exit is linked to the block of `pc` once it is translated if `chain` is set
+void jit_emit_exit(JitCtx *c, vaddr_t pc, bool chain);
+// exit translated code with the next pc in eax
+void jit_emit_exit_indirect(JitCtx *c);
+void jit_invalidate(vaddr_t pc);
+void jit_flush();
+
+#endif
@@ -0,0 +1,47 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_WATCHPOINT_H__
+#define __CPU_WATCHPOINT_H__
+
+#include <common.h>
+
+/* Watchpoints are not evaluated after every instruction. A watchpoint
+ * on a word of memory is checked after stores to the word, and one on a
+ * register is checked after instructions whose `rd` is the register.
+ * Only the other watchpoints are evaluated after every instruction.
+ */
+#ifndef CONFIG_TARGET_AM
+extern int wp_nr_store;       // number of watchpoints on memory
+extern uint32_t wp_reg_mask;  // registers with watchpoints on them
+extern bool wp_pending;       // some watchpoint should be checked after this instruction
+
+bool wp_active();
+void wp_store_hit(vaddr_t addr, int len);
+void wp_check();
+
+static inline void wp_check_store(vaddr_t addr, int len) {
+  if (unlikely(wp_nr_store > 0)) wp_store_hit(addr, len);
+}
+
+static inline void wp_check_rd(int rd) {
+  if (unlikely((wp_reg_mask >> rd) & 1)) wp_pending = true;
+}
+#else
+static inline void wp_check_store(vaddr_t addr, int len) {}
+static inline void wp_check_rd(int rd) {}
+#endif
+
+#endif
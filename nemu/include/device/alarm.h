@@ -21,4 +21,12 @@
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
 
+#ifdef CONFIG_ICOUNT
+// alarms are raised by alarm_fire() when g_nr_guest_inst reaches this
+extern uint64_t alarm_deadline;
+void alarm_fire();
+// move the virtual time forward to the next alarm
+void alarm_skip();
+#endif
+
 #endif
@@ -0,0 +1,35 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_IDLE_H__
+#define __DEVICE_IDLE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_IDLE_DETECT
+extern int idle_nr_poll;  // polls in a row without any store in between
+// called by devices when the guest reads them but nothing has changed
+void device_idle_poll();
+// called on every guest store and port write, which may be what the polls wait for
+static inline void device_idle_reset() { idle_nr_poll = 0; }
+// the guest waits for the next device event
+void device_idle_wait();
+#else
+static inline void device_idle_poll() {}
+static inline void device_idle_reset() {}
+static inline void device_idle_wait() {}
+#endif
+
+#endif
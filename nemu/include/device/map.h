@@ -17,9 +17,12 @@
 #define __DEVICE_MAP_H__
 
 #include <cpu/difftest.h>
+#include <memory/paddr.h>
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
+// all register spaces allocated so far, `size` can be NULL
+uint8_t* io_space_used(size_t *size);
 
 typedef struct {
   const char *name;
@@ -34,21 +37,40 @@ static inline bool map_inside(IOMap *map, paddr_t addr) {
   return (addr >= map->low && addr <= map->high);
 }
 
-static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
-  int i;
-  for (i = 0; i < size; i ++) {
-    if (map_inside(maps + i, addr)) {
-      difftest_skip_ref();
-      return i;
-    }
+/* A set of non-overlapping maps. Each map is allocated on its own, so
+ * that pointers to it remain valid, while `sorted` orders them by address
+ * and grows as maps are added. A lookup first tries the map hit last time,
+ * since accesses to a device usually come in bursts, and then falls back
+ * to binary search.
+ */
+typedef struct {
+  IOMap **sorted;
+  int nr_map;
+  int max_map;
+  IOMap *last;  // the map hit last time
+} IOMapTable;
+
+void add_map(IOMapTable *t, IOMap map);
+
+static inline IOMap* find_map_by_addr(IOMapTable *t, paddr_t addr) {
+  if (likely(t->last != NULL && map_inside(t->last, addr))) return t->last;
+  int lo = 0, hi = t->nr_map - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    IOMap *map = t->sorted[mid];
+    if (addr < map->low) hi = mid - 1;
+    else if (addr > map->high) lo = mid + 1;
+    else { t->last = map; return map; }
   }
-  return -1;
+  return NULL;
 }
 
 void add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 void add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
+RamRegion* add_mmio_ram_map(const char *name, paddr_t addr,
+        void *space, uint32_t len, int dirty_shift);
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
@@ -32,10 +32,24 @@ void init_isa();
 extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+// index of the general purpose register `name` written as `rd`, or -1
+int isa_gpr_idx(const char *name);
+// host address of the register `name`, or NULL if it is only a part of a word
+const word_t* isa_reg_addr(const char *name);
 
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+#ifdef CONFIG_ENGINE_THREADED
+struct TBlock;
+void isa_translate_block(struct TBlock *tb, vaddr_t pc);
+uint64_t isa_exec_block(struct Decode *s, struct TBlock *tb);
+#endif
+#ifdef CONFIG_ENGINE_JIT
+struct JitCtx;
+int isa_jit_translate(struct JitCtx *c, vaddr_t pc);
+bool isa_inst_implemented(vaddr_t pc, uint32_t inst);
+#endif
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
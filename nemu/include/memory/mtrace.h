@@ -0,0 +1,38 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __MEMORY_MTRACE_H__
+#define __MEMORY_MTRACE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_MTRACE
+extern bool mtrace_enable;
+extern paddr_t mtrace_low, mtrace_high;
+
+void init_mtrace(const char *file, const char *range, bool mmio_only);
+void mtrace_record(paddr_t addr, int len, word_t data, bool is_write);
+void mtrace_flush();
+void mtrace_fork_child();
+
+// called with the physical address of every data access
+static inline void mtrace_access(paddr_t addr, int len, word_t data, bool is_write) {
+  if (unlikely(mtrace_enable) && addr - mtrace_low <= mtrace_high - mtrace_low) {
+    mtrace_record(addr, len, data, is_write);
+  }
+}
+#endif
+
+#endif
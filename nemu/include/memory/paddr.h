@@ -17,6 +17,12 @@
 #define __MEMORY_PADDR_H__
 
 #include <common.h>
+#include <memory/host.h>
+#ifdef CONFIG_DECODE_CACHE
+#include <cpu/decode-cache.h>
+#endif
+#include <cpu/difftest.h>
+#include <device/idle.h>
 
 #define PMEM_LEFT  ((paddr_t)CONFIG_MBASE)
 #define PMEM_RIGHT ((paddr_t)CONFIG_MBASE + CONFIG_MSIZE - 1)
@@ -34,4 +40,112 @@ static inline bool in_pmem(paddr_t addr) {
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+// --- inlined fast path for accesses to pmem ---
+#if defined(CONFIG_PMEM_MALLOC)
+extern uint8_t *pmem;
+#else
+extern uint8_t pmem[];
+#endif
+
+/* MMIO regions without callbacks, such as the frame buffer, are also
+ * accessed like pmem. Instead of callbacks, stores are recorded in a
+ * dirty bitmap, one bit for every (1 << dirty_shift) bytes.
+ */
+typedef struct {
+  paddr_t low;
+  uint32_t len;
+  uint8_t *space;
+  int dirty_shift;
+  uint64_t *dirty;
+} RamRegion;
+
+#define NR_RAM_REGION 4
+extern RamRegion ram_region[NR_RAM_REGION];
+extern int nr_ram_region;
+
+#ifdef CONFIG_DEVICE
+static inline RamRegion* ram_region_find(paddr_t addr, int len) {
+  for (int i = 0; i < nr_ram_region; i ++) {
+    RamRegion *r = &ram_region[i];
+    if (addr - r->low <= r->len - len) return r;
+  }
+  return NULL;
+}
+#else
+static inline RamRegion* ram_region_find(paddr_t addr, int len) { return NULL; }
+#endif
+
+static inline void ram_region_set_dirty(RamRegion *r, paddr_t offset, int len) {
+  paddr_t first = offset >> r->dirty_shift, last = (offset + len - 1) >> r->dirty_shift;
+  r->dirty[first / 64] |= 1ull << (first % 64);
+  r->dirty[last / 64] |= 1ull << (last % 64);
+}
+
+static inline void ram_region_write(RamRegion *r, paddr_t addr, int len, word_t data) {
+  difftest_skip_ref();
+  ram_region_set_dirty(r, addr - r->low, len);
+  host_write(r->space + (addr - r->low), len, data);
+  device_idle_reset();
+}
+
+/* Accesses lying entirely in pmem are done with a single bounds check,
+ * then come the MMIO regions mapped as RAM. Others go to the out-of-line
+ * paddr_read() and paddr_write().
+ */
+#define PMEM_FAST_ACCESS(bits) \
+static inline word_t concat(paddr_read, bits)(paddr_t addr) { \
+  if (likely(addr - CONFIG_MBASE <= CONFIG_MSIZE - bits / 8)) { \
+    return *(uint##bits##_t *)(pmem + (addr - CONFIG_MBASE)); \
+  } \
+  RamRegion *r = ram_region_find(addr, bits / 8); \
+  if (r != NULL) { \
+    difftest_skip_ref(); \
+    return *(uint##bits##_t *)(r->space + (addr - r->low)); \
+  } \
+  return paddr_read(addr, bits / 8); \
+} \
+static inline void concat(paddr_write, bits)(paddr_t addr, word_t data) { \
+  if (likely(addr - CONFIG_MBASE <= CONFIG_MSIZE - bits / 8)) { \
+    IFDEF(CONFIG_DECODE_CACHE, decode_cache_check_write(addr, bits / 8)); \
+    *(uint##bits##_t *)(pmem + (addr - CONFIG_MBASE)) = data; \
+    return; \
+  } \
+  RamRegion *r = ram_region_find(addr, bits / 8); \
+  if (r != NULL) { \
+    difftest_skip_ref(); \
+    ram_region_set_dirty(r, addr - r->low, bits / 8); \
+    *(uint##bits##_t *)(r->space + (addr - r->low)) = data; \
+    return; \
+  } \
+  paddr_write(addr, bits / 8, data); \
+}
+
+PMEM_FAST_ACCESS(8)
+PMEM_FAST_ACCESS(16)
+PMEM_FAST_ACCESS(32)
+#ifdef CONFIG_ISA64
+PMEM_FAST_ACCESS(64)
+#endif
+
+// `len` is usually a constant, so that the switch is folded
+static inline word_t paddr_read_fast(paddr_t addr, int len) {
+  switch (len) {
+    case 1: return paddr_read8(addr);
+    case 2: return paddr_read16(addr);
+    case 4: return paddr_read32(addr);
+    IFDEF(CONFIG_ISA64, case 8: return paddr_read64(addr));
+    default: return paddr_read(addr, len);
+  }
+}
+
+static inline void paddr_write_fast(paddr_t addr, int len, word_t data) {
+  switch (len) {
+    case 1: paddr_write8(addr, data); return;
+    case 2: paddr_write16(addr, data); return;
+    case 4: paddr_write32(addr, data); return;
+    IFDEF(CONFIG_ISA64, case 8: paddr_write64(addr, data); return);
+    default: paddr_write(addr, len, data);
+  }
+}
+
 #endif
@@ -16,14 +16,63 @@
 #ifndef __MEMORY_VADDR_H__
 #define __MEMORY_VADDR_H__
 
-#include <common.h>
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/mtrace.h>
+#include <cpu/watchpoint.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
+// read and write for the debugger without tracing, counting or touching
+// devices, return false if `addr` does not map to pmem
+bool vaddr_debug_read(vaddr_t addr, int len, word_t *data);
+bool vaddr_debug_write(vaddr_t addr, int len, word_t data);
 
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
 #define PAGE_MASK         (PAGE_SIZE - 1)
 
+#ifdef CONFIG_INST_STAT
+extern uint64_t inst_stat_load, inst_stat_store, inst_stat_mmio;
+#endif
+
+// every data access is traced and counted here with its physical address
+static inline void data_access_hook(paddr_t addr, int len, word_t data, bool is_write) {
+  IFDEF(CONFIG_MTRACE, mtrace_access(addr, len, data, is_write));
+  if (is_write) device_idle_reset();
+#ifdef CONFIG_INST_STAT
+  if (is_write) inst_stat_store ++;
+  else inst_stat_load ++;
+  if (!in_pmem(addr)) inst_stat_mmio ++;
+#endif
+}
+
+/* Accesses without address translation go to the inlined fast path
+ * in memory/paddr.h. isa_mmu_check() is a constant for most ISAs.
+ */
+static inline word_t vaddr_read_fast(vaddr_t addr, int len) {
+  if (isa_mmu_check(addr, len, MEM_TYPE_READ) == MMU_DIRECT) {
+    word_t data = paddr_read_fast(addr, len);
+    data_access_hook(addr, len, data, false);
+    return data;
+  }
+  return vaddr_read(addr, len);
+}
+
+static inline void vaddr_write_fast(vaddr_t addr, int len, word_t data) {
+  if (isa_mmu_check(addr, len, MEM_TYPE_WRITE) == MMU_DIRECT) {
+    wp_check_store(addr, len);
+    data_access_hook(addr, len, data, true);
+    paddr_write_fast(addr, len, data);
+    return;
+  }
+  vaddr_write(addr, len, data);
+}
+
+#ifdef CONFIG_TLB
+void tlb_flush();
+void tlb_statistic();
+#endif
+
 #endif
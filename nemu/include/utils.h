@@ -33,6 +33,17 @@ extern NEMUState nemu_state;
 // ----------- timer -----------
 
 uint64_t get_time();
+// time seen by the guest, which is the host time or derived from
+// the number of instructions executed in icount mode
+uint64_t get_guest_time();
+
+// ----------- checkpoint -----------
+
+#ifdef CONFIG_CHECKPOINT
+enum { CKPT_FULL, CKPT_INCREMENTAL, CKPT_RAW };
+bool checkpoint_save(const char *file, int type);
+bool checkpoint_load(const char *file);
+#endif
 
 // ----------- log -----------
 
@@ -61,17 +72,103 @@ uint64_t get_time();
     extern FILE* log_fp; \
     extern bool log_enable(); \
     if (log_enable() && log_fp != NULL) { \
-      fprintf(log_fp, __VA_ARGS__); \
-      fflush(log_fp); \
+      MUXDEF(CONFIG_LOG_ASYNC, log_printf(__VA_ARGS__), \
+        (fprintf(log_fp, __VA_ARGS__), fflush(log_fp))); \
     } \
   } while (0) \
 )
 
+#ifdef CONFIG_LOG_ASYNC
+void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#endif
+
 #define _Log(...) \
   do { \
     printf(__VA_ARGS__); \
     log_write(__VA_ARGS__); \
   } while (0)
 
+// ----------- itrace -----------
+
+#ifdef CONFIG_ITRACE
+/* Instructions are recorded in binary into a ring buffer. They are
+ * only disassembled when they are printed.
+ */
+typedef struct {
+  vaddr_t pc;
+  uint8_t len;
+  uint8_t inst[MUXDEF(CONFIG_ISA_x86, 16, 4)];
+} ITraceRecord;
+
+extern ITraceRecord itrace_ringbuf[CONFIG_ITRACE_RINGBUF_SIZE];
+extern uint64_t itrace_nr;
+
+static inline void itrace_record(vaddr_t pc, const void *inst, int len) {
+  ITraceRecord *r = &itrace_ringbuf[itrace_nr ++ % CONFIG_ITRACE_RINGBUF_SIZE];
+  r->pc = pc;
+  r->len = len;
+  memcpy(r->inst, inst, sizeof(r->inst));
+}
+
+void itrace_format_last(char *buf, int size);
+void itrace_dump();
+void disasm_statistic();
+#endif
+
+// ----------- elf symbols -----------
+
+void init_elf(const char *elf_file);
+int elf_symbol_find(vaddr_t addr);
+const char* elf_symbol_name(int idx);
+vaddr_t elf_symbol_addr(int idx);
+
+// ----------- ftrace -----------
+
+#ifdef CONFIG_FTRACE
+extern bool ftrace_enable;
+void init_ftrace(const char *elf_file, const char *folded_file);
+void ftrace_event(vaddr_t pc, vaddr_t target, bool is_call);
+void ftrace_reset();
+void ftrace_fork_child();
+
+// called by the ISA when a function is called or returns
+static inline void ftrace_call(vaddr_t pc, vaddr_t target) {
+  if (unlikely(ftrace_enable)) ftrace_event(pc, target, true);
+}
+
+static inline void ftrace_ret(vaddr_t pc, vaddr_t target) {
+  if (unlikely(ftrace_enable)) ftrace_event(pc, target, false);
+}
+#endif
+
+// ----------- profile -----------
+
+#ifdef CONFIG_PROFILE
+#define PROFILE_SHIFT MUXDEF(CONFIG_ISA_x86, 0, 2)  // log2 of the minimal instruction length
+#define PROFILE_NR_SLOT ((uint64_t)CONFIG_MSIZE >> PROFILE_SHIFT)
+#define PROFILE_NR_REPORT 10
+
+extern uint64_t *profile_count;
+void init_profile(const char *folded_file);
+void profile_reset();
+void profile_report();
+void profile_fork_child();
+
+#ifdef CONFIG_PROFILE_EXACT
+extern vaddr_t profile_next_pc;
+void profile_slow(vaddr_t pc);
+
+// called for every instruction executed, `snpc` is its static next pc
+static inline void profile_inst(vaddr_t pc, vaddr_t snpc) {
+  uint64_t idx = (uint64_t)(pc - CONFIG_MBASE) >> PROFILE_SHIFT;
+  if (likely(pc == profile_next_pc && idx < PROFILE_NR_SLOT && profile_count[idx] != 0)) profile_count[idx] ++;
+  else profile_slow(pc);
+  profile_next_pc = snpc;
+}
+#else
+extern uint64_t profile_deadline;
+void profile_sample(vaddr_t pc);
+#endif
+#endif
 
 #endif
@@ -16,6 +16,12 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/watchpoint.h>
+#include <cpu/breakpoint.h>
+#ifdef CONFIG_DECODE_CACHE
+#include <cpu/decode-cache.h>
+#endif
+#include <memory/vaddr.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -31,13 +37,82 @@ static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+bool log_enable();
+void log_flush();
+
+#ifdef CONFIG_ENGINE_THREADED
+uint64_t tcache_exec(Decode *s, vaddr_t pc, uint64_t n);
+void tcache_statistic();
+#endif
+#ifdef CONFIG_ENGINE_JIT
+uint64_t jit_exec(uint64_t n);
+void jit_statistic();
+#endif
+#ifdef CONFIG_IDLE_DETECT
+void idle_statistic();
+#endif
+
+#ifdef CONFIG_DEVICE
+#include <device/alarm.h>
+
+#ifdef CONFIG_EXEC_BATCH
+// devices are updated again when g_nr_guest_inst reaches this
+static uint64_t g_device_deadline = 0;
+#endif
+
+static inline void update_device(bool precise) {
+  IFDEF(CONFIG_ICOUNT, if (unlikely(g_nr_guest_inst >= alarm_deadline)) alarm_fire());
+#ifdef CONFIG_EXEC_BATCH
+  // an instruction count check is much cheaper than the host time query in device_update()
+  if (likely(!precise && g_nr_guest_inst < g_device_deadline)) return;
+  g_device_deadline = g_nr_guest_inst + CONFIG_EXEC_BATCH_SIZE;
+#endif
+  device_update();
+}
+#endif
+
+// the number of instructions a translated block may run,
+// blocks do not run across the next alarm in icount mode
+static inline uint64_t block_budget(uint64_t n) {
+#ifdef CONFIG_ICOUNT
+  uint64_t left = alarm_deadline - g_nr_guest_inst;
+  if (left < n) return left;
+#endif
+  return n;
+}
+
+#ifdef CONFIG_PROFILE_SAMPLE
+static inline void sample_pc() {
+  if (unlikely(g_nr_guest_inst >= profile_deadline)) profile_sample(cpu.pc);
+}
+#endif
+
+// stop before the instruction at `pc` if it is a breakpoint
+static inline void check_breakpoint(vaddr_t pc) {
+#ifndef CONFIG_TARGET_AM
+  if (likely(bp_nr == 0)) return;
+  // breakpoints are never held by the decode cache
+  IFDEF(CONFIG_DECODE_CACHE, if (likely(decode_cache_lookup(pc)->pc == pc)) return);
+  if (bp_find(pc)) bp_hit(pc);
+#endif
+}
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+#ifdef CONFIG_ITRACE
+  // only format the instruction when it is really output
+  bool to_log = false;
 #ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
+  to_log = ITRACE_COND && log_enable();
+#endif
+  if (to_log || g_print_step) {
+    char buf[128];
+    itrace_format_last(buf, sizeof(buf));
+    if (to_log) { log_write("%s\n", buf); }
+    if (g_print_step) { puts(buf); }
+  }
 #endif
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+  IFNDEF(CONFIG_TARGET_AM, if (unlikely(wp_pending)) wp_check());
 }
 
 static void exec_once(Decode *s, vaddr_t pc) {
@@ -45,40 +120,52 @@ static void exec_once(Decode *s, vaddr_t pc) {
   s->snpc = pc;
   isa_exec_once(s);
   cpu.pc = s->dnpc;
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
-  int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst;
-#ifdef CONFIG_ISA_x86
-  for (i = 0; i < ilen; i ++) {
-#else
-  for (i = ilen - 1; i >= 0; i --) {
-#endif
-    p += snprintf(p, 4, " %02x", inst[i]);
-  }
-  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
-  int space_len = ilen_max - ilen;
-  if (space_len < 0) space_len = 0;
-  space_len = space_len * 3 + 1;
-  memset(p, ' ', space_len);
-  p += space_len;
-
-  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst, ilen);
-#endif
+  IFDEF(CONFIG_ITRACE, itrace_record(s->pc, &s->isa.inst, s->snpc - s->pc));
+  IFDEF(CONFIG_PROFILE_EXACT, profile_inst(s->pc, s->snpc));
+  IFDEF(CONFIG_INST_STAT, if (s->dnpc != s->snpc) inst_stat_jump ++);
 }
 
 static void execute(uint64_t n) {
   Decode s;
+  // itrace, difftest, exact profiling, instruction statistics, mtrace, ftrace,
+  // watchpoints and single-stepping need to observe every single instruction
+  bool precise = g_print_step || ISDEF(CONFIG_ITRACE) || ISDEF(CONFIG_DIFFTEST) || ISDEF(CONFIG_PROFILE_EXACT) ||
+    ISDEF(CONFIG_INST_STAT) ||
+    MUXDEF(CONFIG_MTRACE, mtrace_enable, false) || MUXDEF(CONFIG_FTRACE, ftrace_enable, false) ||
+    MUXNDEF(CONFIG_TARGET_AM, wp_active(), false);
+  (void)precise;
   for (;n > 0; n --) {
+#ifdef CONFIG_ENGINE_THREADED
+    uint64_t nr_block = (!precise ? tcache_exec(&s, cpu.pc, block_budget(n)) : 0);
+    if (nr_block > 0) {
+      cpu.pc = s.dnpc;
+      g_nr_guest_inst += nr_block;
+      n -= nr_block - 1;
+      check_breakpoint(cpu.pc);
+      if (nemu_state.state != NEMU_RUNNING) break;
+      IFDEF(CONFIG_DEVICE, update_device(precise));
+      IFDEF(CONFIG_PROFILE_SAMPLE, sample_pc());
+      continue;
+    }
+#elif defined(CONFIG_ENGINE_JIT)
+    uint64_t nr_block = (!precise ? jit_exec(block_budget(n)) : 0);
+    if (nr_block > 0) {
+      g_nr_guest_inst += nr_block;
+      n -= nr_block - 1;
+      check_breakpoint(cpu.pc);
+      if (nemu_state.state != NEMU_RUNNING) break;
+      IFDEF(CONFIG_DEVICE, update_device(precise));
+      IFDEF(CONFIG_PROFILE_SAMPLE, sample_pc());
+      continue;
+    }
+#endif
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
+    check_breakpoint(cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    IFDEF(CONFIG_DEVICE, update_device(precise));
+    IFDEF(CONFIG_PROFILE_SAMPLE, sample_pc());
   }
 }
 
@@ -89,11 +176,22 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_ITRACE, disasm_statistic());
+  IFDEF(CONFIG_DECODE_CACHE, decode_cache_statistic());
+  IFDEF(CONFIG_TLB, tlb_statistic());
+  IFDEF(CONFIG_ENGINE_THREADED, tcache_statistic());
+  IFDEF(CONFIG_ENGINE_JIT, jit_statistic());
+  IFDEF(CONFIG_IDLE_DETECT, idle_statistic());
+  IFDEF(CONFIG_PROFILE, profile_report());
+  IFDEF(CONFIG_INST_STAT, inst_stat_display());
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_ITRACE, itrace_dump());
+  IFDEF(CONFIG_MTRACE, mtrace_flush());
   isa_reg_display();
   statistic();
+  IFNDEF(CONFIG_TARGET_AM, log_flush());
 }
 
 /* Simulate how the CPU works. */
@@ -105,6 +203,8 @@ void cpu_exec(uint64_t n) {
       return;
     default: nemu_state.state = NEMU_RUNNING;
   }
+  // g_nr_guest_inst may go backwards after restoring a checkpoint
+  IFDEF(CONFIG_EXEC_BATCH, g_device_deadline = 0);
 
   uint64_t timer_start = get_time();
 
@@ -122,6 +222,9 @@ void cpu_exec(uint64_t n) {
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
             ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
           nemu_state.halt_pc);
+#ifdef CONFIG_ITRACE
+      if (nemu_state.state == NEMU_ABORT || nemu_state.halt_ret != 0) itrace_dump();
+#endif
       // fall through
     case NEMU_QUIT: statistic();
   }
@@ -0,0 +1,71 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <cpu/decode-cache.h>
+#include <memory/paddr.h>
+#ifdef CONFIG_ENGINE_JIT
+#include <cpu/jit.h>
+#endif
+
+static_assert((CONFIG_DECODE_CACHE_SIZE & (CONFIG_DECODE_CACHE_SIZE - 1)) == 0,
+    "CONFIG_DECODE_CACHE_SIZE must be a power of 2");
+
+DecodeCacheEntry decode_cache[CONFIG_DECODE_CACHE_SIZE] = {
+  [0 ... CONFIG_DECODE_CACHE_SIZE - 1] = { .pc = DECODE_CACHE_INVALID }
+};
+// one bit for each instruction word in pmem which is held by the decode cache
+uint32_t decode_cache_code[CONFIG_MSIZE / 4 / 32] = {};
+uint64_t decode_cache_hit = 0, decode_cache_miss = 0;
+
+void decode_cache_fill(DecodeCacheEntry *e, vaddr_t pc, uint32_t inst,
+    const void *exec, int rd, int rs1, int rs2, word_t imm) {
+  // instructions outside pmem (e.g. fetched from MMIO) are never cached,
+  // since stores to them can not be tracked
+  if (!in_pmem(pc)) return;
+  *e = (DecodeCacheEntry) { .pc = pc, .inst = inst, .exec = exec,
+    .rd = rd, .rs1 = rs1, .rs2 = rs2, .imm = imm };
+  decode_cache_mark(pc);
+}
+
+void decode_cache_mark(vaddr_t pc) {
+  paddr_t idx = (pc - CONFIG_MBASE) >> 2;
+  decode_cache_code[idx / 32] |= 1u << (idx % 32);
+}
+
+void decode_cache_invalidate(paddr_t addr) {
+  vaddr_t pc = addr & ~(paddr_t)3;
+  DecodeCacheEntry *e = decode_cache_lookup(pc);
+  if (e->pc == pc) e->pc = DECODE_CACHE_INVALID;
+  IFDEF(CONFIG_ENGINE_THREADED, tcache_invalidate(pc));
+  IFDEF(CONFIG_ENGINE_JIT, jit_invalidate(pc));
+  paddr_t idx = (pc - CONFIG_MBASE) >> 2;
+  decode_cache_code[idx / 32] &= ~(1u << (idx % 32));
+}
+
+void decode_cache_flush() {
+  for (int i = 0; i < CONFIG_DECODE_CACHE_SIZE; i ++) {
+    decode_cache[i].pc = DECODE_CACHE_INVALID;
+  }
+  IFDEF(CONFIG_ENGINE_THREADED, tcache_flush());
+  IFDEF(CONFIG_ENGINE_JIT, jit_flush());
+  memset(decode_cache_code, 0, sizeof(decode_cache_code));
+}
+
+void decode_cache_statistic() {
+  uint64_t total = decode_cache_hit + decode_cache_miss;
+  Log("decode cache: hit = %" PRIu64 ", miss = %" PRIu64 ", hit rate = %.2f%%",
+      decode_cache_hit, decode_cache_miss, total ? 100.0 * decode_cache_hit / total : 0.0);
+}
@@ -0,0 +1,116 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+void instpat_table_add(InstPatTable *t, uint64_t key, uint64_t mask, const void *exec) {
+  if (t->nr_pat == t->max_pat) {
+    t->max_pat = (t->max_pat == 0 ? 64 : t->max_pat * 2);
+    t->pat = realloc(t->pat, sizeof(t->pat[0]) * t->max_pat);
+    assert(t->pat);
+  }
+  t->pat[t->nr_pat ++] = (InstPatEntry) { .key = key, .mask = mask, .exec = exec };
+}
+
+// how well bit `b` splits the patterns: the smaller one of the
+// numbers of patterns requiring it to be 0 and to be 1
+static int bit_score(InstPatTable *t, int b) {
+  int n[2] = {};
+  for (int i = 0; i < t->nr_pat; i ++) {
+    if ((t->pat[i].mask >> b) & 1) n[(t->pat[i].key >> b) & 1] ++;
+  }
+  return n[0] < n[1] ? n[0] : n[1];
+}
+
+static uint64_t select_bits(InstPatTable *t) {
+  int score[64];
+  for (int b = 0; b < 64; b ++) score[b] = bit_score(t, b);
+  uint64_t sel = 0;
+  for (int k = 0; k < INSTPAT_TABLE_BITS; k ++) {
+    int best = -1;
+    for (int b = 0; b < 64; b ++) {
+      if (score[b] > 0 && (best == -1 || score[b] > score[best])) best = b;
+    }
+    if (best == -1) break;
+    sel |= 1ull << best;
+    score[best] = 0;
+  }
+  return sel;
+}
+
+// whether pattern `p` may match an instruction whose selected bits are `bits`
+static bool pat_may_match(InstPatEntry *p, uint64_t sel, uint64_t bits) {
+  return ((bits ^ p->key) & p->mask & sel) == 0;
+}
+
+// the inverse of the indexing in instpat_lookup()
+static uint64_t index_to_bits(InstPatTable *t, uint32_t idx) {
+  uint64_t bits = 0;
+  for (int i = 0; i < t->nr_field; i ++) {
+    bits |= ((uint64_t)(idx >> t->field[i].pos) & BITMASK(t->field[i].len)) << t->field[i].lo;
+  }
+  return bits;
+}
+
+void instpat_table_build(InstPatTable *t, const void *end) {
+  uint64_t sel = select_bits(t);
+
+  // split the selected bits into fields of consecutive bits
+  int nbits = 0;
+  t->nr_field = 0;
+  for (int b = 0; b < 64; b ++) {
+    if (!((sel >> b) & 1)) continue;
+    if (b > 0 && ((sel >> (b - 1)) & 1)) t->field[t->nr_field - 1].len ++;
+    else t->field[t->nr_field ++] = (InstPatField) { .lo = b, .len = 1, .pos = nbits };
+    nbits ++;
+  }
+
+  int nr_bucket = 1 << nbits;
+  InstPatEntry **bucket = malloc(sizeof(bucket[0]) * nr_bucket);
+  int *nr_cand = malloc(sizeof(nr_cand[0]) * nr_bucket);
+  assert(bucket && nr_cand);
+
+  // the candidates of an index stop at the first pattern decided by the selected bits alone
+  int total = 0;
+  for (int idx = 0; idx < nr_bucket; idx ++) {
+    uint64_t bits = index_to_bits(t, idx);
+    int n = 0;
+    for (int i = 0; i < t->nr_pat; i ++) {
+      InstPatEntry *p = &t->pat[i];
+      if (!pat_may_match(p, sel, bits)) continue;
+      n ++;
+      if ((p->mask & ~sel) == 0) break;
+    }
+    nr_cand[idx] = n;
+    total += n + 1;
+  }
+
+  InstPatEntry *pool = malloc(sizeof(pool[0]) * total);
+  assert(pool);
+  InstPatEntry *q = pool;
+  for (int idx = 0; idx < nr_bucket; idx ++) {
+    uint64_t bits = index_to_bits(t, idx);
+    bucket[idx] = q;
+    for (int i = 0, n = 0; n < nr_cand[idx]; i ++) {
+      if (pat_may_match(&t->pat[i], sel, bits)) { *q ++ = t->pat[i]; n ++; }
+    }
+    // no pattern matches
+    *q ++ = (InstPatEntry) { .key = 0, .mask = 0, .exec = end };
+  }
+  free(nr_cand);
+
+  t->bucket = bucket;
+  t->ready = true;
+}
@@ -0,0 +1,56 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+#include <memory/vaddr.h>
+
+uint64_t instpat_count[NR_INSTPAT_ID] = {};
+static const char *instpat_name[NR_INSTPAT_ID] = {};
+uint64_t inst_stat_jump = 0;
+uint64_t inst_stat_load = 0, inst_stat_store = 0, inst_stat_mmio = 0;
+
+void instpat_stat_register(int id, const char *name) {
+  instpat_name[id] = name;
+}
+
+static int cmp_count(const void *a, const void *b) {
+  uint64_t x = instpat_count[*(const int *)a], y = instpat_count[*(const int *)b];
+  return (x < y) - (x > y);
+}
+
+void inst_stat_display() {
+  static int id[NR_INSTPAT_ID];
+  uint64_t total = 0;
+  int n = 0;
+  for (int i = 0; i < NR_INSTPAT_ID; i ++) {
+    if (instpat_count[i] == 0) continue;
+    total += instpat_count[i];
+    id[n ++] = i;
+  }
+  if (total == 0) {
+    Log("instruction mix: no instruction has been counted");
+    return;
+  }
+  qsort(id, n, sizeof(id[0]), cmp_count);
+
+  Log("instruction mix of %" PRIu64 " instructions:", total);
+  for (int i = 0; i < n; i ++) {
+    _Log("  %6.2f%% %12" PRIu64 "  %s\n", 100.0 * instpat_count[id[i]] / total,
+        instpat_count[id[i]], instpat_name[id[i]]);
+  }
+  Log("loads = %.2f%%, stores = %.2f%%, taken branches and jumps = %.2f%%, mmio accesses = %.2f%%",
+      100.0 * inst_stat_load / total, 100.0 * inst_stat_store / total,
+      100.0 * inst_stat_jump / total, 100.0 * inst_stat_mmio / total);
+}
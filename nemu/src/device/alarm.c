@@ -35,7 +35,29 @@ static void alarm_sig_handler(int signum) {
   }
 }
 
+#ifdef CONFIG_ICOUNT
+#define ALARM_PERIOD (CONFIG_ICOUNT_FREQ / TIMER_HZ)
+static_assert(ALARM_PERIOD > 0, "CONFIG_ICOUNT_FREQ is lower than TIMER_HZ");
+uint64_t alarm_deadline = ALARM_PERIOD;
+
+void alarm_fire() {
+  alarm_deadline += ALARM_PERIOD;
+  alarm_sig_handler(SIGVTALRM);
+}
+
+void alarm_skip() {
+  extern uint64_t g_nr_guest_inst, g_nr_skip_inst;
+  if (alarm_deadline <= g_nr_guest_inst) return;
+  g_nr_skip_inst += alarm_deadline - g_nr_guest_inst;
+  alarm_deadline = g_nr_guest_inst;
+}
+#endif
+
 void init_alarm() {
+#ifdef CONFIG_ICOUNT
+  // no host timer, see alarm_fire()
+  return;
+#endif
   struct sigaction s;
   memset(&s, 0, sizeof(s));
   s.sa_handler = alarm_sig_handler;
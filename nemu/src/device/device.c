@@ -33,13 +33,28 @@ void init_alarm();
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
+static uint64_t last = 0;
+// a child forked by sdb must not touch the window and events of the parent
+static bool host_detached = false;
+
+void device_fork_child() {
+  host_detached = true;
+  // interval timers are not inherited by fork()
+  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+}
+
+// time of the next update, which is the next chance to see a new event
+uint64_t device_next_update() {
+  return last + 1000000 / TIMER_HZ;
+}
+
 void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
+  uint64_t now = get_guest_time();
   if (now - last < 1000000 / TIMER_HZ) {
     return;
   }
   last = now;
+  if (host_detached) return;
 
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
@@ -0,0 +1,56 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <utils.h>
+#include <device/alarm.h>
+#include <device/idle.h>
+#include <unistd.h>
+
+// polls which are farther apart than this are not in a tight loop
+#define IDLE_WINDOW 256
+
+uint64_t device_next_update();
+void device_update();
+
+static uint64_t last_poll = 0;
+int idle_nr_poll = 0;
+static uint64_t nr_wait = 0;
+
+void device_idle_poll() {
+  extern uint64_t g_nr_guest_inst;
+  if (g_nr_guest_inst - last_poll > IDLE_WINDOW) idle_nr_poll = 0;
+  last_poll = g_nr_guest_inst;
+  if (++ idle_nr_poll >= CONFIG_IDLE_THRESHOLD) device_idle_wait();
+}
+
+void device_idle_wait() {
+  idle_nr_poll = 0;
+  nr_wait ++;
+#ifdef CONFIG_ICOUNT
+  // nothing can happen before the next alarm, so jump to it
+  alarm_skip();
+#else
+  uint64_t next = device_next_update();
+  uint64_t now = get_guest_time();
+  if (next > now) usleep(next - now);
+  // deliver the event now instead of at the end of the batch
+  device_update();
+#endif
+}
+
+void idle_statistic() {
+  Log("idle: waits for device events = %" PRIu64, nr_wait);
+}
@@ -17,6 +17,7 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
+#include <device/idle.h>
 
 #define IO_SPACE_MAX (32 * 1024 * 1024)
 
@@ -46,6 +47,33 @@ static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_wr
   if (c != NULL) { c(offset, len, is_write); }
 }
 
+void add_map(IOMapTable *t, IOMap map) {
+  for (int k = 0; k < t->nr_map; k ++) {
+    IOMap *m = t->sorted[k];
+    if (map.low <= m->high && map.high >= m->low) {
+      panic("IO map %s@[" FMT_PADDR ", " FMT_PADDR "] is overlapped with %s@[" FMT_PADDR ", " FMT_PADDR "]",
+          map.name, map.low, map.high, m->name, m->low, m->high);
+    }
+  }
+  if (t->nr_map == t->max_map) {
+    t->max_map = (t->max_map == 0 ? 16 : t->max_map * 2);
+    t->sorted = realloc(t->sorted, sizeof(t->sorted[0]) * t->max_map);
+    assert(t->sorted);
+  }
+  IOMap *p = malloc(sizeof(*p));
+  assert(p);
+  *p = map;
+  int i = t->nr_map;
+  for (; i > 0 && t->sorted[i - 1]->low > map.low; i --) t->sorted[i] = t->sorted[i - 1];
+  t->sorted[i] = p;
+  t->nr_map ++;
+}
+
+uint8_t* io_space_used(size_t *size) {
+  if (size != NULL) *size = p_space - io_space;
+  return io_space;
+}
+
 void init_map() {
   io_space = malloc(IO_SPACE_MAX);
   assert(io_space);
@@ -55,6 +83,7 @@ void init_map() {
 word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  difftest_skip_ref();
   paddr_t offset = addr - map->low;
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
@@ -64,7 +93,9 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  difftest_skip_ref();
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
+  device_idle_reset();
 }
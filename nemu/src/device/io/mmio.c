@@ -16,14 +16,10 @@
 #include <device/map.h>
 #include <memory/paddr.h>
 
-#define NR_MAP 16
-
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+static IOMapTable maps = {};
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  return find_map_by_addr(&maps, addr);
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -34,23 +30,32 @@ static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
 
 /* device interface */
 void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
-  assert(nr_map < NR_MAP);
   paddr_t left = addr, right = addr + len - 1;
   if (in_pmem(left) || in_pmem(right)) {
     report_mmio_overlap(name, left, right, "pmem", PMEM_LEFT, PMEM_RIGHT);
   }
-  for (int i = 0; i < nr_map; i++) {
-    if (left <= maps[i].high && right >= maps[i].low) {
-      report_mmio_overlap(name, left, right, maps[i].name, maps[i].low, maps[i].high);
-    }
-  }
+  // overlaps with other devices are checked by add_map()
+
+  add_map(&maps, (IOMap){ .name = name, .low = left, .high = right,
+    .space = space, .callback = callback });
+  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]", name, left, right);
+}
 
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
-    .space = space, .callback = callback };
-  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
+RamRegion ram_region[NR_RAM_REGION] = {};
+int nr_ram_region = 0;
 
-  nr_map ++;
+/* Map a region without callback as RAM, so that the memory fast path
+ * accesses it directly. Return the region to query its dirty bitmap.
+ */
+RamRegion* add_mmio_ram_map(const char *name, paddr_t addr, void *space, uint32_t len, int dirty_shift) {
+  assert(nr_ram_region < NR_RAM_REGION);
+  add_mmio_map(name, addr, space, len, NULL);
+  int nr_granule = ((len - 1) >> dirty_shift) + 1;
+  RamRegion *r = &ram_region[nr_ram_region ++];
+  *r = (RamRegion) { .low = addr, .len = len, .space = space,
+    .dirty_shift = dirty_shift, .dirty = calloc((nr_granule + 63) / 64, sizeof(uint64_t)) };
+  assert(r->dirty);
+  return r;
 }
 
 /* bus interface */
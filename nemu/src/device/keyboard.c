@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/idle.h>
 #include <utils.h>
 
 #define KEYDOWN_MASK 0x8000
@@ -64,6 +65,20 @@ static uint32_t key_dequeue() {
   return key;
 }
 
+// queue a press and a release of the key `name`, such as "A" or "RETURN"
+bool send_key_name(const char *name) {
+#define NEMU_KEY_STR(k) #k,
+  static const char *names[] = { "NONE", MAP(NEMU_KEYS, NEMU_KEY_STR) };
+  for (int i = NEMU_KEY_NONE + 1; i < ARRLEN(names); i ++) {
+    if (strcasecmp(name, names[i]) == 0) {
+      key_enqueue(i | KEYDOWN_MASK);
+      key_enqueue(i);
+      return true;
+    }
+  }
+  return false;
+}
+
 void send_key(uint8_t scancode, bool is_keydown) {
   if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != NEMU_KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
@@ -86,6 +101,7 @@ static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
   i8042_data_port_base[0] = key_dequeue();
+  if (i8042_data_port_base[0] == NEMU_KEY_NONE) device_idle_poll();
 }
 
 void init_i8042() {
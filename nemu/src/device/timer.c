@@ -15,6 +15,7 @@
 
 #include <device/map.h>
 #include <device/alarm.h>
+#include <device/idle.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
@@ -22,9 +23,10 @@ static uint32_t *rtc_port_base = NULL;
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    uint64_t us = get_guest_time();
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
+    device_idle_poll();
   }
 }
 
@@ -33,6 +33,12 @@ static uint32_t screen_size() {
 
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
+static RamRegion *vmem_region = NULL;
+
+// number of words in the dirty bitmap of vmem
+static uint32_t vmem_dirty_words() {
+  return ((screen_size() - 1) >> vmem_region->dirty_shift) / 64 + 1;
+}
 
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
@@ -56,8 +62,12 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static inline void update_rows(int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, (uint32_t *)vmem + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+}
+
+static inline void present_screen() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -65,15 +75,47 @@ static inline void update_screen() {
 #else
 static void init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static inline void update_rows(int y, int h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint32_t *)vmem + y * screen_width(), screen_width(), h, true);
 }
+
+static inline void present_screen() {}
 #endif
+
+/* Only upload the scanlines touched since the last update. Each run of
+ * dirty granules in the vmem dirty bitmap becomes one band of scanlines,
+ * and nothing is uploaded at all if the screen is static.
+ */
+static inline void update_screen() {
+  uint64_t *dirty = vmem_region->dirty;
+  int shift = vmem_region->dirty_shift;
+  int nr_granule = ((screen_size() - 1) >> shift) + 1;
+  uint32_t row_size = screen_width() * sizeof(uint32_t);
+  bool updated = false;
+  int g = 0;
+  while (g < nr_granule) {
+    if (dirty[g / 64] == 0) { g = (g / 64 + 1) * 64; continue; }
+    if (!(dirty[g / 64] & (1ull << (g % 64)))) { g ++; continue; }
+    int start = g;
+    while (g < nr_granule && (dirty[g / 64] & (1ull << (g % 64)))) g ++;
+    int y0 = ((uint32_t)start << shift) / row_size;
+    int y1 = (((uint32_t)g << shift) - 1) / row_size;
+    if (y1 >= screen_height()) y1 = screen_height() - 1;
+    update_rows(y0, y1 - y0 + 1);
+    updated = true;
+  }
+  if (!updated) return;
+  memset(dirty, 0, vmem_dirty_words() * sizeof(uint64_t));
+  present_screen();
+}
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  // the guest requests a redraw by writing a non-zero value to the sync register
+  if (vgactl_port_base[1] != 0) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+    vgactl_port_base[1] = 0;
+  }
 }
 
 void init_vga() {
@@ -86,7 +128,10 @@ void init_vga() {
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
+  // 1KB granules, which are less than one scanline for all screen sizes
+  vmem_region = add_mmio_ram_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), 10);
   IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  // upload the whole screen at the first update
+  memset(vmem_region->dirty, 0xff, vmem_dirty_words() * sizeof(uint64_t));
 }
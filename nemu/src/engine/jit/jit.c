@@ -0,0 +1,246 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/jit.h>
+#include <cpu/decode-cache.h>
+#include <cpu/breakpoint.h>
+#include <memory/paddr.h>
+#include <sys/mman.h>
+
+#ifndef __x86_64__
+#error The JIT engine only supports x86-64 hosts
+#endif
+
+#define CODE_CACHE_SIZE (16 * 1024 * 1024)
+// a block is only translated when at least this much space is left
+#define MAX_BLOCK_CODE  (64 * 1024)
+#define NR_BLOCK 4096
+// number of visits to a block before it is translated,
+// cold code is executed by `isa_exec_once()` instead
+#define JIT_HOT_THRESHOLD 2
+// maximum number of instructions executed in one entry of translated code,
+// so that devices are still updated when blocks are chained into a loop
+#define JIT_SLICE 65536
+// number of exits which can be linked to their target blocks at the same time
+#define NR_LINK 16384
+// number of buckets of the page index of links, a power of 2
+#define NR_LINK_PAGE 256
+
+typedef struct {
+  vaddr_t pc;        // tag
+  uint8_t *code;
+  vaddr_t hot_pc;    // candidate block which is not translated yet
+  uint32_t nr_visit;
+} JitBlock;
+
+// returned in rax:rdx by the exit trampoline
+typedef struct {
+  uint64_t pc;
+  uint8_t *chain;    // the linkable jump which leads to this exit, or NULL
+} JitExit;
+
+// an exit linked to the block at `pc` by patching its jump at `site`
+typedef struct JitLink {
+  uint8_t *site;
+  vaddr_t pc;
+  struct JitLink *page_next;  // next link indexed by the same target page
+} JitLink;
+
+static JitBlock block_table[NR_BLOCK] = {};
+static JitLink link_pool[NR_LINK];
+static JitLink *free_link = NULL;
+// links indexed by the page of their targets, so that invalidating
+// a page only unlinks the exits leading into it
+static JitLink *link_index[NR_LINK_PAGE] = {};
+static uint8_t *code_cache = NULL;
+static uint8_t *code_start = NULL;  // code after the trampolines
+static uint8_t *code_free = NULL;
+static uint8_t *exit_trampoline = NULL;
+static JitExit (*jit_enter)(void *code, CPU_state *cpu, uint8_t *mem, int64_t *budget) = NULL;
+
+static uint64_t nr_translate = 0, nr_flush = 0, nr_chain = 0, nr_jit_inst = 0, nr_invalidate = 0;
+
+void jit_emit_exit(JitCtx *c, vaddr_t pc, bool chain) {
+  uint8_t *site = NULL;
+  if (chain) {
+    // jump to the slow path below until it is linked to the target block
+    site = c->p;
+    int32_t *rel = x86_jmp(c);
+    x86_patch(rel, c->p);
+  }
+  x86_mov_ri(c, RAX, pc);
+  if (chain) x86_lea_rip(c, RDX, site);
+  else x86_op_rr(c, X86_XOR, RDX, RDX);
+  x86_patch(x86_jmp(c), exit_trampoline);
+}
+
+void jit_emit_exit_indirect(JitCtx *c) {
+  x86_op_rr(c, X86_XOR, RDX, RDX);
+  x86_patch(x86_jmp(c), exit_trampoline);
+}
+
+void jit_flush() {
+  int i;
+  for (i = 0; i < NR_BLOCK; i ++) {
+    block_table[i].pc = block_table[i].hot_pc = (vaddr_t)-1;
+  }
+  for (i = 0; i < NR_LINK_PAGE; i ++) link_index[i] = NULL;
+  free_link = NULL;
+  for (i = 0; i < NR_LINK; i ++) {
+    link_pool[i].page_next = free_link;
+    free_link = &link_pool[i];
+  }
+  code_free = code_start;
+  nr_flush ++;
+}
+
+static void gen_trampolines() {
+  JitCtx c = { .p = code_cache, .end = code_cache + CODE_CACHE_SIZE };
+
+  // JitExit jit_enter(void *code, CPU_state *cpu, uint8_t *mem, int64_t *budget)
+  jit_enter = (void *)c.p;
+  x86_push(&c, RBX); x86_push(&c, RBP);
+  x86_push(&c, R12); x86_push(&c, R13); x86_push(&c, R14); x86_push(&c, R15);
+  x86_push(&c, RCX); // also keeps the stack 16-byte aligned
+  x86_rex(&c, 1, RSI, 0, JIT_CPU); emit8(&c, 0x89); emit8(&c, MODRM(3, RSI, JIT_CPU));
+  x86_rex(&c, 1, RDX, 0, JIT_MEM); emit8(&c, 0x89); emit8(&c, MODRM(3, RDX, JIT_MEM));
+  x86_load(&c, 1, JIT_BUDGET, RCX, 0);
+  x86_jmp_r(&c, RDI);
+
+  exit_trampoline = c.p;
+  x86_pop(&c, RCX);
+  x86_store(&c, 1, RCX, 0, JIT_BUDGET);
+  x86_pop(&c, R15); x86_pop(&c, R14); x86_pop(&c, R13); x86_pop(&c, R12);
+  x86_pop(&c, RBP); x86_pop(&c, RBX);
+  x86_ret(&c);
+
+  code_start = (uint8_t *)ROUNDUP(c.p, 64);
+}
+
+void init_jit() {
+  code_cache = mmap(NULL, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  Assert(code_cache != MAP_FAILED, "Can not allocate the code cache for JIT");
+  gen_trampolines();
+  jit_flush();
+  nr_flush = 0;
+}
+
+static inline JitBlock* block_lookup(vaddr_t pc) {
+  return &block_table[(pc >> 2) & (NR_BLOCK - 1)];
+}
+
+static inline JitLink** link_bucket(vaddr_t pc) {
+  return &link_index[(pc >> TB_PAGE_SHIFT) & (NR_LINK_PAGE - 1)];
+}
+
+// patch the exit jump at `site` to the block at `pc`
+static void link_exit(uint8_t *site, JitBlock *target) {
+  // when all links are in use, the exit simply keeps its slow path
+  if (free_link == NULL) return;
+  JitLink *l = free_link;
+  free_link = l->page_next;
+  JitLink **bucket = link_bucket(target->pc);
+  *l = (JitLink) { .site = site, .pc = target->pc, .page_next = *bucket };
+  *bucket = l;
+  x86_patch((int32_t *)(site + 1), target->code);
+  nr_chain ++;
+}
+
+// return the translated block at `pc`, translate it if it becomes hot
+static JitBlock* get_block(vaddr_t pc) {
+  JitBlock *b = block_lookup(pc);
+  if (likely(b->pc == pc)) return b;
+
+  if (b->hot_pc != pc) {
+    b->hot_pc = pc;
+    b->nr_visit = 0;
+  }
+  if (++ b->nr_visit < JIT_HOT_THRESHOLD) return NULL;
+
+  if (code_cache + CODE_CACHE_SIZE - code_free < MAX_BLOCK_CODE) {
+    jit_flush();
+    b->hot_pc = pc;
+  }
+  JitCtx c = { .p = code_free, .end = code_free + MAX_BLOCK_CODE };
+  if (isa_jit_translate(&c, pc) == 0) return NULL;
+  Assert(c.p <= c.end, "translated code of block at " FMT_WORD " is too large", pc);
+
+  b->pc = pc;
+  b->code = code_free;
+  code_free = (uint8_t *)ROUNDUP(c.p, 16);
+  nr_translate ++;
+  return b;
+}
+
+/* Run translated code from `cpu.pc` for at most `n` instructions.
+ * Return the number of instructions executed, or 0 if the caller
+ * should fall back to `isa_exec_once()`.
+ */
+uint64_t jit_exec(uint64_t n) {
+  JitBlock *b = get_block(cpu.pc);
+  if (b == NULL) return 0;
+
+  int64_t budget = (n < JIT_SLICE ? n : JIT_SLICE);
+  int64_t start = budget;
+  JitExit e = jit_enter(b->code, &cpu, guest_to_host(PMEM_LEFT), &budget);
+  cpu.pc = e.pc;
+
+  if (e.chain != NULL) {
+    uint64_t flush = nr_flush;
+    JitBlock *target = get_block(e.pc);
+    // the exit is gone if the code cache is flushed during translation,
+    // and a block at a breakpoint is always entered from here to check it
+    if (target != NULL && flush == nr_flush && !bp_at(e.pc)) link_exit(e.chain, target);
+  }
+
+  nr_jit_inst += start - budget;
+  return start - budget;
+}
+
+// called when a cached instruction is modified, drop the blocks in its page
+void jit_invalidate(vaddr_t pc) {
+  if (code_free == code_start) return;
+  vaddr_t page = pc >> TB_PAGE_SHIFT;
+
+  // exits linked into the page go through their slow paths again
+  JitLink **p = link_bucket(pc);
+  while (*p != NULL) {
+    JitLink *l = *p;
+    if (l->pc >> TB_PAGE_SHIFT == page) {
+      x86_patch((int32_t *)(l->site + 1), l->site + 5);
+      *p = l->page_next;
+      l->page_next = free_link;
+      free_link = l;
+    } else p = &l->page_next;
+  }
+
+  // the code of the dropped blocks is only reclaimed by the next flush
+  vaddr_t start = page << TB_PAGE_SHIFT;
+  for (vaddr_t a = start; a < start + (1u << TB_PAGE_SHIFT); a += 4) {
+    JitBlock *b = block_lookup(a);
+    if (b->pc == a) b->pc = (vaddr_t)-1;
+  }
+  nr_invalidate ++;
+}
+
+void jit_statistic() {
+  extern uint64_t g_nr_guest_inst;
+  Log("jit: translated blocks = %" PRIu64 ", linked exits = %" PRIu64 ", code cache flushes = %" PRIu64
+      ", invalidated pages = %" PRIu64, nr_translate, nr_chain, nr_flush, nr_invalidate);
+  Log("jit: instructions executed in translated code = %" PRIu64 " (%.2f%%)",
+      nr_jit_inst, g_nr_guest_inst ? 100.0 * nr_jit_inst / g_nr_guest_inst : 0.0);
+}
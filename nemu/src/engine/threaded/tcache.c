@@ -0,0 +1,105 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/decode.h>
+#include <cpu/decode-cache.h>
+
+#define NR_TB 1024
+// number of visits to a block before it is translated,
+// cold code is executed by `isa_exec_once()` instead
+#define TB_HOT_THRESHOLD 2
+// number of buckets of the page index, a power of 2
+#define NR_TB_PAGE 256
+
+static TBlock tcache[NR_TB] = {
+  [0 ... NR_TB - 1] = { .pc = DECODE_CACHE_INVALID, .hot_pc = DECODE_CACHE_INVALID }
+};
+// valid blocks linked by `page_next`, so that a store only looks at
+// the blocks in its own page
+static TBlock *page_index[NR_TB_PAGE] = {};
+static uint64_t nr_translate = 0, nr_block_inst = 0;
+
+static inline TBlock* tcache_lookup(vaddr_t pc) {
+  return &tcache[(pc >> 2) & (NR_TB - 1)];
+}
+
+static inline TBlock** page_bucket(vaddr_t pc) {
+  return &page_index[(pc >> TB_PAGE_SHIFT) & (NR_TB_PAGE - 1)];
+}
+
+static void tb_invalidate(TBlock *tb) {
+  if (tb->pc != DECODE_CACHE_INVALID) {
+    TBlock **p = page_bucket(tb->pc);
+    while (*p != tb) p = &(*p)->page_next;
+    *p = tb->page_next;
+  }
+  int i;
+  for (i = 0; i < tb->ninst; i ++) {
+    // this also stops the threaded dispatch if `tb` is being executed
+    tb->inst[i].pc = DECODE_CACHE_INVALID;
+  }
+  tb->pc = DECODE_CACHE_INVALID;
+}
+
+/* Execute the block starting at `pc` if it is hot and contains at most `n`
+ * instructions. Return the number of instructions executed, or 0 if the
+ * caller should fall back to `isa_exec_once()`.
+ */
+uint64_t tcache_exec(Decode *s, vaddr_t pc, uint64_t n) {
+  TBlock *tb = tcache_lookup(pc);
+  if (unlikely(tb->pc != pc)) {
+    if (tb->hot_pc != pc) {
+      tb->hot_pc = pc;
+      tb->nr_visit = 0;
+    }
+    if (++ tb->nr_visit < TB_HOT_THRESHOLD) return 0;
+    tb_invalidate(tb);
+    isa_translate_block(tb, pc);
+    nr_translate ++;
+    if (tb->pc != pc) return 0;
+    TBlock **bucket = page_bucket(pc);
+    tb->page_next = *bucket;
+    *bucket = tb;
+  }
+  if (tb->ninst > n) return 0;
+
+  uint64_t nr = isa_exec_block(s, tb);
+  nr_block_inst += nr;
+  return nr;
+}
+
+// invalidate all blocks containing the instruction at `pc`
+void tcache_invalidate(vaddr_t pc) {
+  TBlock *tb = *page_bucket(pc), *next;
+  for (; tb != NULL; tb = next) {
+    next = tb->page_next;
+    if (pc - tb->pc < tb->ninst * 4) tb_invalidate(tb);
+  }
+}
+
+void tcache_flush() {
+  int i;
+  for (i = 0; i < NR_TB; i ++) {
+    tb_invalidate(&tcache[i]);
+  }
+}
+
+void tcache_statistic() {
+  extern uint64_t g_nr_guest_inst;
+  Log("translated blocks = %" PRIu64 ", instructions executed in blocks = %" PRIu64 " (%.2f%%)",
+      nr_translate, nr_block_inst, g_nr_guest_inst ? 100.0 * nr_block_inst / g_nr_guest_inst : 0.0);
+}
@@ -17,10 +17,11 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/watchpoint.h>
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+#define Mr vaddr_read_fast
+#define Mw vaddr_write_fast
 
 enum {
   TYPE_2RI12, TYPE_1RI20,
@@ -51,7 +52,9 @@ static int decode_exec(Decode *s) {
   int rd = 0; \
   word_t src1 = 0, src2 = 0, imm = 0; \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  INSTPAT_COUNT(); \
   __VA_ARGS__ ; \
+  wp_check_rd(rd); \
 }
 
   INSTPAT_START();
@@ -17,26 +17,43 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/watchpoint.h>
+#include <cpu/breakpoint.h>
+#include <device/idle.h>
+#ifdef CONFIG_DECODE_CACHE
+#include <cpu/decode-cache.h>
+#endif
+#ifdef CONFIG_ENGINE_THREADED
+#include <memory/paddr.h>
+#endif
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+#define Mr vaddr_read_fast
+#define Mw vaddr_write_fast
+
+/* Report function calls and returns to ftrace, it should be used
+ * by `jal` and `jalr` after `s->dnpc` is set. A jump linking to `ra`
+ * is a call, and `jalr zero, 0(ra)` is a return.
+ */
+#define ftrace_jump(s, rd, rs1) IFDEF(CONFIG_FTRACE, do { \
+  if ((rd) == 1) ftrace_call((s)->pc, (s)->dnpc); \
+  else if ((rd) == 0 && (rs1) == 1) ftrace_ret((s)->pc, (s)->dnpc); \
+} while (0))
 
 enum {
   TYPE_I, TYPE_U, TYPE_S,
   TYPE_N, // none
 };
 
-#define src1R() do { *src1 = R(rs1); } while (0)
-#define src2R() do { *src2 = R(rs2); } while (0)
+// source registers not used by the instruction type are left as $zero
+#define src1R() do { *rs1 = BITS(i, 19, 15); } while (0)
+#define src2R() do { *rs2 = BITS(i, 24, 20); } while (0)
 #define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
 #define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
 
-static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
+static void decode_operand(Decode *s, int *rd, int *rs1, int *rs2, word_t *imm, int type) {
   uint32_t i = s->isa.inst;
-  int rs1 = BITS(i, 19, 15);
-  int rs2 = BITS(i, 24, 20);
   *rd     = BITS(i, 11, 7);
   switch (type) {
     case TYPE_I: src1R();          immI(); break;
@@ -47,15 +64,45 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   }
 }
 
-static int decode_exec(Decode *s) {
+#if defined(CONFIG_ENGINE_THREADED) || defined(CONFIG_ENGINE_JIT)
+// when set, a matched pattern is only recorded but not executed
+static bool translating = false;
+#define INSTPAT_TRANSLATE_ONLY() do { if (translating) goto *(__instpat_end); } while (0)
+#else
+#define INSTPAT_TRANSLATE_ONLY()
+#endif
+
+/* With the decode cache, the entries in [e, end) have already been decoded
+ * and are executed one after another by jumping to their execute bodies,
+ * as long as control flows sequentially. Otherwise `e` is filled with the
+ * decoding result of the instruction in `s`.
+ */
+static int decode_exec(Decode *s IFDEF(CONFIG_DECODE_CACHE, , DecodeCacheEntry *e, DecodeCacheEntry *end)) {
+  int rd = 0, rs1 = 0, rs2 = 0;
+  word_t src1 = 0, src2 = 0, imm = 0;
   s->dnpc = s->snpc;
 
+#ifdef CONFIG_DECODE_CACHE
+  if (likely(e < end)) {
+dispatch:
+    rd = e->rd; rs1 = e->rs1; rs2 = e->rs2; imm = e->imm;
+    goto *e->exec;
+  }
+#endif
+
 #define INSTPAT_INST(s) ((s)->isa.inst)
+#define INSTPAT_EXEC_LABEL concat(__instpat_exec_, __LINE__)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
-  int rd = 0; \
-  word_t src1 = 0, src2 = 0, imm = 0; \
-  decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  decode_operand(s, &rd, &rs1, &rs2, &imm, concat(TYPE_, type)); \
+  IFDEF(CONFIG_DECODE_CACHE, \
+    decode_cache_fill(e, s->pc, s->isa.inst, &&INSTPAT_EXEC_LABEL, rd, rs1, rs2, imm); \
+    INSTPAT_TRANSLATE_ONLY(); \
+    INSTPAT_EXEC_LABEL:) \
+  INSTPAT_COUNT(); \
+  src1 = R(rs1); \
+  src2 = R(rs2); \
   __VA_ARGS__ ; \
+  wp_check_rd(rd); \
 }
 
   INSTPAT_START();
@@ -64,15 +111,108 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
 
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, device_idle_wait());
+  INSTPAT("0001001 ????? ????? 000 00000 11100 11", sfence_vma, N,
+      IFDEF(CONFIG_TLB, tlb_flush()); IFNDEF(CONFIG_TLB, IFDEF(CONFIG_DECODE_CACHE, decode_cache_flush())));
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
   R(0) = 0; // reset $zero to 0
 
+#ifdef CONFIG_DECODE_CACHE
+  // threaded dispatch to the next decoded instruction
+  if (++e < end && e->pc == s->dnpc && likely(nemu_state.state == NEMU_RUNNING)) {
+    s->pc = e->pc;
+    s->snpc = s->dnpc = e->pc + 4;
+    s->isa.inst = e->inst;
+    goto dispatch;
+  }
+#endif
+
   return 0;
 }
 
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_DECODE_CACHE
+  DecodeCacheEntry *e = decode_cache_lookup(s->pc);
+  if (likely(e->pc == s->pc)) {
+    decode_cache_hit ++;
+    s->isa.inst = e->inst;
+    s->snpc += 4;
+    return decode_exec(s, e, e + 1);
+  }
+  decode_cache_miss ++;
+  // breakpoints are never cached, so that hits need no check for them
+  static DecodeCacheEntry uncached;
+  if (unlikely(bp_at(s->pc))) e = &uncached;
+#endif
   s->isa.inst = inst_fetch(&s->snpc, 4);
-  return decode_exec(s);
+  return decode_exec(s IFDEF(CONFIG_DECODE_CACHE, , e, e));
+}
+
+#ifdef CONFIG_ENGINE_THREADED
+static bool is_block_end(uint32_t inst) {
+  switch (BITS(inst, 6, 0)) {
+    case 0b1101111: // jal
+    case 0b1100111: // jalr
+    case 0b1100011: // branch
+    case 0b1110011: // system
+    case 0b0001111: // fence
+      return true;
+    default: return false;
+  }
+}
+
+void isa_translate_block(TBlock *tb, vaddr_t pc) {
+  Decode s;
+  int n = 0;
+  translating = true;
+  while (n < TB_MAX_INST && in_pmem(pc)) {
+    // a breakpoint starts a new block, where it is checked
+    if (n > 0 && bp_at(pc)) break;
+    if (n > 0 && pc % (1u << TB_PAGE_SHIFT) == 0) break;
+    DecodeCacheEntry *e = &tb->inst[n];
+    s.pc = s.snpc = pc;
+    s.isa.inst = inst_fetch(&s.snpc, 4);
+    e->pc = DECODE_CACHE_INVALID;
+    decode_exec(&s, e, e);
+    assert(e->pc == pc);
+    n ++;
+    pc += 4;
+    if (is_block_end(s.isa.inst)) break;
+  }
+  translating = false;
+  tb->ninst = n;
+  tb->pc = (n > 0 ? tb->inst[0].pc : DECODE_CACHE_INVALID);
+}
+
+uint64_t isa_exec_block(Decode *s, TBlock *tb) {
+  // `tb` may be invalidated by a store inside itself
+  vaddr_t start = tb->pc;
+  s->pc = start;
+  s->snpc = start + 4;
+  s->isa.inst = tb->inst[0].inst;
+  decode_exec(s, tb->inst, tb->inst + tb->ninst);
+  return (s->pc - start) / 4 + 1;
+}
+#endif
+
+#ifdef CONFIG_ENGINE_JIT
+// decode `inst` at `pc` in pmem without executing it, return the execute body it leads to
+static const void* decode_only(vaddr_t pc, uint32_t inst) {
+  Decode s = { .pc = pc, .snpc = pc + 4, .isa.inst = inst };
+  DecodeCacheEntry e = { .exec = NULL };
+  translating = true;
+  decode_exec(&s, &e, &e);
+  translating = false;
+  return e.exec;
+}
+
+// whether the patterns above implement `inst` at `pc`, the JIT leaves the others to them
+bool isa_inst_implemented(vaddr_t pc, uint32_t inst) {
+  // the all-zero word is always illegal, and hence reaches `inv`
+  static const void *inv_exec = NULL;
+  if (inv_exec == NULL) inv_exec = decode_only(pc, 0);
+  return decode_only(pc, inst) != inv_exec;
 }
+#endif
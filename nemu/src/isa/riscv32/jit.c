@@ -0,0 +1,295 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/jit.h>
+#include <cpu/decode-cache.h>
+#include <cpu/breakpoint.h>
+#include <memory/paddr.h>
+#include <stddef.h>
+
+/* Translate RV32I basic blocks into x86-64 code. Only the instructions which
+ * do not touch the machine state other than gpr and pmem, and which are also
+ * implemented by the interpreter, are translated. A block ends before the
+ * first unsupported instruction, which is then executed by isa_exec_once().
+ */
+
+#define JIT_MAX_INST 64
+#define JIT_MAX_EXIT JIT_MAX_INST
+
+#define NR_HOST_REG 3
+static const int host_reg[NR_HOST_REG] = { RBX, R12, R13 };
+
+enum {
+  OP_LUI = 0x37, OP_AUIPC = 0x17, OP_JAL = 0x6f, OP_JALR = 0x67, OP_BRANCH = 0x63,
+  OP_LOAD = 0x03, OP_STORE = 0x23, OP_IMM = 0x13, OP_REG = 0x33,
+};
+
+#define opcode(i) BITS(i, 6, 0)
+#define funct3(i) BITS(i, 14, 12)
+#define funct7(i) BITS(i, 31, 25)
+#define rd(i)     BITS(i, 11, 7)
+#define rs1(i)    BITS(i, 19, 15)
+#define rs2(i)    BITS(i, 24, 20)
+#define immI(i) ((word_t)SEXT(BITS(i, 31, 20), 12))
+#define immU(i) ((word_t)SEXT(BITS(i, 31, 12), 20) << 12)
+#define immS(i) ((word_t)(SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7))
+#define immB(i) ((word_t)(SEXT(BITS(i, 31, 31), 1) << 12) | (BITS(i, 7, 7) << 11) | \
+                 (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1))
+#define immJ(i) ((word_t)(SEXT(BITS(i, 31, 31), 1) << 20) | (BITS(i, 19, 12) << 12) | \
+                 (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1))
+
+typedef struct {
+  int32_t *rel;  // jump to the exit
+  int idx;       // index of the instruction which is not executed
+} EarlyExit;
+
+static int8_t alloc[32];  // guest register -> index of host_reg, or -1
+static EarlyExit early_exit[JIT_MAX_EXIT];
+static int nr_early_exit;
+
+static bool is_supported(uint32_t i) {
+  switch (opcode(i)) {
+    case OP_LUI: case OP_AUIPC: case OP_JAL: return true;
+    case OP_JALR: return funct3(i) == 0;
+    case OP_BRANCH: return funct3(i) != 2 && funct3(i) != 3;
+    case OP_LOAD: return funct3(i) != 3 && funct3(i) < 6;
+    case OP_STORE: return funct3(i) < 3;
+    case OP_IMM:
+      if (funct3(i) == 1) return funct7(i) == 0;
+      if (funct3(i) == 5) return funct7(i) == 0 || funct7(i) == 0x20;
+      return true;
+    case OP_REG:
+      return funct7(i) == 0 || (funct7(i) == 0x20 && (funct3(i) == 0 || funct3(i) == 5));
+    default: return false;
+  }
+}
+
+static bool is_block_end(uint32_t i) {
+  return opcode(i) == OP_JAL || opcode(i) == OP_JALR || opcode(i) == OP_BRANCH;
+}
+
+static inline int32_t gpr_offset(int r) {
+  return offsetof(CPU_state, gpr) + r * sizeof(word_t);
+}
+
+static void load_reg(JitCtx *c, int dst, int r) {
+  if (r == 0) x86_op_rr(c, X86_XOR, dst, dst);
+  else if (alloc[r] >= 0) x86_mov_rr(c, dst, host_reg[alloc[r]]);
+  else x86_load(c, 0, dst, JIT_CPU, gpr_offset(r));
+}
+
+static void write_reg(JitCtx *c, int r, int src) {
+  if (r == 0) return;
+  if (alloc[r] >= 0) x86_mov_rr(c, host_reg[alloc[r]], src);
+  else x86_store(c, 0, JIT_CPU, gpr_offset(r), src);
+}
+
+static void writeback(JitCtx *c) {
+  for (int r = 1; r < 32; r ++) {
+    if (alloc[r] >= 0) x86_store(c, 0, JIT_CPU, gpr_offset(r), host_reg[alloc[r]]);
+  }
+}
+
+// give the most frequently used guest registers in the block to host registers
+static void alloc_regs(uint32_t *inst, int n) {
+  int count[32] = {};
+  for (int k = 0; k < n; k ++) {
+    uint32_t i = inst[k];
+    int op = opcode(i);
+    if (op != OP_STORE && op != OP_BRANCH) count[rd(i)] ++;
+    if (op != OP_LUI && op != OP_AUIPC && op != OP_JAL) count[rs1(i)] ++;
+    if (op == OP_STORE || op == OP_BRANCH || op == OP_REG) count[rs2(i)] ++;
+  }
+  count[0] = 0;
+  memset(alloc, -1, sizeof(alloc));
+  for (int h = 0; h < NR_HOST_REG; h ++) {
+    int best = 0;
+    for (int r = 1; r < 32; r ++) {
+      if (alloc[r] < 0 && count[r] > count[best]) best = r;
+    }
+    // loading and writing back a register used only once is not worth it
+    if (count[best] < 2) break;
+    alloc[best] = h;
+  }
+}
+
+static void add_early_exit(int32_t *rel, int idx) {
+  Assert(nr_early_exit < JIT_MAX_EXIT, "too many early exits");
+  early_exit[nr_early_exit ++] = (EarlyExit) { .rel = rel, .idx = idx };
+}
+
+// ecx = rs1 + imm - MBASE, exit to the interpreter if [ecx, ecx + len) is out of pmem
+static void gen_pmem_addr(JitCtx *c, uint32_t i, word_t imm, int len, int idx) {
+  load_reg(c, RCX, rs1(i));
+  x86_alu_ri(c, 0, EXT_ADD, RCX, imm - CONFIG_MBASE);
+  x86_alu_ri(c, 0, EXT_CMP, RCX, CONFIG_MSIZE - len);
+  add_early_exit(x86_jcc(c, CC_A), idx);
+}
+
+// exit to the interpreter if the instruction word holding the byte at [r15 + rcx + off] is cached
+static void gen_code_check(JitCtx *c, int off, int idx) {
+  x86_mov_rr(c, RDX, RCX);
+  if (off != 0) x86_alu_ri(c, 0, EXT_ADD, RDX, off);
+  x86_shift_ri(c, EXT_SHR, RDX, 2);
+  x86_bt_m(c, R11, RDX);
+  add_early_exit(x86_jcc(c, CC_B), idx);
+}
+
+static void gen_inst(JitCtx *c, vaddr_t pc, uint32_t i, int idx) {
+  int f3 = funct3(i);
+  switch (opcode(i)) {
+    case OP_LUI:   x86_mov_ri(c, RAX, immU(i)); write_reg(c, rd(i), RAX); break;
+    case OP_AUIPC: x86_mov_ri(c, RAX, pc + immU(i)); write_reg(c, rd(i), RAX); break;
+
+    case OP_IMM: {
+      word_t imm = immI(i);
+      load_reg(c, RAX, rs1(i));
+      switch (f3) {
+        case 0: x86_alu_ri(c, 0, EXT_ADD, RAX, imm); break;
+        case 2: x86_alu_ri(c, 0, EXT_CMP, RAX, imm); x86_setcc_zx(c, CC_L, RAX); break;
+        case 3: x86_alu_ri(c, 0, EXT_CMP, RAX, imm); x86_setcc_zx(c, CC_B, RAX); break;
+        case 4: x86_alu_ri(c, 0, EXT_XOR, RAX, imm); break;
+        case 6: x86_alu_ri(c, 0, EXT_OR,  RAX, imm); break;
+        case 7: x86_alu_ri(c, 0, EXT_AND, RAX, imm); break;
+        case 1: x86_shift_ri(c, EXT_SHL, RAX, imm & 0x1f); break;
+        case 5: x86_shift_ri(c, funct7(i) ? EXT_SAR : EXT_SHR, RAX, imm & 0x1f); break;
+      }
+      write_reg(c, rd(i), RAX);
+      break;
+    }
+
+    case OP_REG:
+      load_reg(c, RAX, rs1(i));
+      load_reg(c, RCX, rs2(i));
+      switch (f3) {
+        case 0: x86_op_rr(c, funct7(i) ? X86_SUB : X86_ADD, RAX, RCX); break;
+        case 1: x86_shift_rcl(c, EXT_SHL, RAX); break;
+        case 2: x86_op_rr(c, X86_CMP, RAX, RCX); x86_setcc_zx(c, CC_L, RAX); break;
+        case 3: x86_op_rr(c, X86_CMP, RAX, RCX); x86_setcc_zx(c, CC_B, RAX); break;
+        case 4: x86_op_rr(c, X86_XOR, RAX, RCX); break;
+        case 5: x86_shift_rcl(c, funct7(i) ? EXT_SAR : EXT_SHR, RAX); break;
+        case 6: x86_op_rr(c, X86_OR,  RAX, RCX); break;
+        case 7: x86_op_rr(c, X86_AND, RAX, RCX); break;
+      }
+      write_reg(c, rd(i), RAX);
+      break;
+
+    case OP_LOAD: {
+      // lb, lh, lw, -, lbu, lhu
+      static const uint16_t op[] = { 0x0fbe, 0x0fbf, 0x8b, 0, 0x0fb6, 0x0fb7 };
+      gen_pmem_addr(c, i, immI(i), 1 << (f3 & 3), idx);
+      x86_guest_mem(c, false, op[f3], RAX);
+      write_reg(c, rd(i), RAX);
+      break;
+    }
+
+    case OP_STORE: {
+      int len = 1 << f3;
+      gen_pmem_addr(c, i, immS(i), len, idx);
+      // stores to cached instructions are left to the interpreter to invalidate them
+      x86_movabs(c, R11, (uintptr_t)decode_cache_code);
+      gen_code_check(c, 0, idx);
+      if (len > 1) gen_code_check(c, len - 1, idx);
+      load_reg(c, RAX, rs2(i));
+      x86_guest_mem(c, f3 == 1, f3 == 0 ? 0x88 : 0x89, RAX);
+      break;
+    }
+
+    case OP_JAL:
+      x86_mov_ri(c, RAX, pc + 4);
+      write_reg(c, rd(i), RAX);
+      writeback(c);
+      jit_emit_exit(c, pc + immJ(i), true);
+      break;
+
+    case OP_JALR:
+      load_reg(c, RAX, rs1(i));
+      x86_alu_ri(c, 0, EXT_ADD, RAX, immI(i));
+      x86_alu_ri(c, 0, EXT_AND, RAX, ~1u);
+      x86_mov_ri(c, RCX, pc + 4);
+      write_reg(c, rd(i), RCX);
+      writeback(c);
+      jit_emit_exit_indirect(c);
+      break;
+
+    case OP_BRANCH: {
+      // beq, bne, -, -, blt, bge, bltu, bgeu
+      static const int cc[] = { CC_E, CC_NE, 0, 0, CC_L, CC_GE, CC_B, CC_AE };
+      load_reg(c, RAX, rs1(i));
+      load_reg(c, RCX, rs2(i));
+      x86_op_rr(c, X86_CMP, RAX, RCX);
+      int32_t *taken = x86_jcc(c, cc[f3]);
+      writeback(c);
+      jit_emit_exit(c, pc + 4, true);
+      x86_patch(taken, c->p);
+      writeback(c);
+      jit_emit_exit(c, pc + immB(i), true);
+      break;
+    }
+
+    default: panic("unsupported instruction " FMT_WORD " at pc = " FMT_WORD, (word_t)i, pc);
+  }
+}
+
+/* Translate the block at `pc` into `c`.
+ * Return the number of guest instructions translated, 0 if nothing is translated.
+ */
+int isa_jit_translate(JitCtx *c, vaddr_t pc) {
+  uint32_t inst[JIT_MAX_INST];
+  int n = 0;
+  if ((pc & 3) != 0) return 0;
+  while (n < JIT_MAX_INST && in_pmem(pc + n * 4)) {
+    // a breakpoint starts a new block, where it is checked
+    if (n > 0 && bp_at(pc + n * 4)) break;
+    // blocks do not cross pages, so that a store only invalidates its own page
+    if (n > 0 && (pc + n * 4) % (1u << TB_PAGE_SHIFT) == 0) break;
+    uint32_t i = *(uint32_t *)guest_to_host(pc + n * 4);
+    if (!is_supported(i) || !isa_inst_implemented(pc + n * 4, i)) break;
+    inst[n ++] = i;
+    if (is_block_end(i)) break;
+  }
+  if (n == 0) return 0;
+
+  alloc_regs(inst, n);
+  nr_early_exit = 0;
+
+  // consume the budget of the whole block, or leave it to the interpreter
+  x86_alu_ri(c, 1, EXT_SUB, JIT_BUDGET, n);
+  add_early_exit(x86_jcc(c, CC_L), 0);
+  for (int r = 1; r < 32; r ++) {
+    if (alloc[r] >= 0) x86_load(c, 0, host_reg[alloc[r]], JIT_CPU, gpr_offset(r));
+  }
+
+  for (int k = 0; k < n; k ++) {
+    // stores to the block are then tracked
+    decode_cache_mark(pc + k * 4);
+    gen_inst(c, pc + k * 4, inst[k], k);
+  }
+  if (!is_block_end(inst[n - 1])) {
+    writeback(c);
+    jit_emit_exit(c, pc + n * 4, true);
+  }
+
+  // give back the budget of the instructions which are not executed
+  for (int k = 0; k < nr_early_exit; k ++) {
+    EarlyExit *e = &early_exit[k];
+    x86_patch(e->rel, c->p);
+    if (e->idx > 0) writeback(c);
+    x86_alu_ri(c, 1, EXT_ADD, JIT_BUDGET, n - e->idx);
+    jit_emit_exit(c, pc + e->idx * 4, false);
+  }
+  return n;
+}
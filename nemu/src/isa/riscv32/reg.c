@@ -26,6 +26,23 @@ const char *regs[] = {
 void isa_reg_display() {
 }
 
+// `s` is the name of a register without the leading '$'
+int isa_gpr_idx(const char *s) {
+  for (int i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    const char *name = regs[i] + (regs[i][0] == '$');
+    if (strcmp(s, name) == 0) return i;
+  }
+  return -1;
+}
+
+const word_t* isa_reg_addr(const char *s) {
+  if (strcmp(s, "pc") == 0) return &cpu.pc;
+  int i = isa_gpr_idx(s);
+  return (i >= 0 ? &gpr(i) : NULL);
+}
+
 word_t isa_reg_str2val(const char *s, bool *success) {
-  return 0;
+  const word_t *r = isa_reg_addr(s);
+  *success = (r != NULL);
+  return (r != NULL ? *r : 0);
 }
@@ -119,8 +119,8 @@ static void decode_rm(Decode *s, int *rm_reg, word_t *rm_addr, int *reg, int wid
 
 #define Rr reg_read
 #define Rw reg_write
-#define Mr vaddr_read
-#define Mw vaddr_write
+#define Mr vaddr_read_fast
+#define Mw vaddr_write_fast
 #define RMr(reg, w)  (reg != -1 ? Rr(reg, w) : Mr(addr, w))
 #define RMw(data) do { if (rd != -1) Rw(rd, w, data); else Mw(addr, w, data); } while (0)
 
@@ -153,6 +153,7 @@ enum {
   int w = width == 0 ? (is_operand_size_16 ? 2 : 4) : width; \
   decode_operand(s, opcode, &rd, &src1, &addr, &rs, &gp_idx, &imm, w, concat(TYPE_, type)); \
   s->dnpc = s->snpc; \
+  INSTPAT_COUNT(); \
   __VA_ARGS__ ; \
 }
 
@@ -56,6 +56,30 @@ void reg_test() {
 void isa_reg_display() {
 }
 
+// registers are also written implicitly, e.g. by push and mul,
+// so they can not be watched by the destination operand
+int isa_gpr_idx(const char *s) {
+  return -1;
+}
+
+// only 32-bit registers have their own words
+const word_t* isa_reg_addr(const char *s) {
+  if (strcmp(s, "pc") == 0 || strcmp(s, "eip") == 0) return &cpu.pc;
+  for (int i = R_EAX; i <= R_EDI; i ++) {
+    if (strcmp(s, regsl[i]) == 0) return &reg_l(i);
+  }
+  return NULL;
+}
+
+// `s` is the name of a register without the leading '$'
 word_t isa_reg_str2val(const char *s, bool *success) {
+  *success = true;
+  const word_t *r = isa_reg_addr(s);
+  if (r != NULL) return *r;
+  for (int i = R_EAX; i <= R_EDI; i ++) {
+    if (strcmp(s, regsw[i]) == 0) return reg_w(i);
+    if (strcmp(s, regsb[i]) == 0) return reg_b(i);
+  }
+  *success = false;
   return 0;
 }
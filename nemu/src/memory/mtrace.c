@@ -0,0 +1,121 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/mtrace.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* The memory trace is a binary stream starting with the 8-byte header
+ * "NEMUMTR" + version, followed by one variable-length record for each
+ * access:
+ *   tag            bit 0: write, bit 1-2: log2(len), bit 3: same pc as the last record
+ *   varint         number of instructions executed before, minus the last one
+ *   zigzag varint  pc minus the last pc, omitted if bit 3 of the tag is set
+ *   zigzag varint  address minus the last address
+ *   varint         data
+ * Varints are little-endian base 128. Decode it with tools/mtrace-decoder.
+ */
+#define MTRACE_VERSION 1
+#define MTRACE_BUF_SIZE (1024 * 1024)
+#define MTRACE_RECORD_MAX 64
+
+bool mtrace_enable = false;
+paddr_t mtrace_low = 0, mtrace_high = 0;
+static bool mtrace_mmio_only = false;
+static int mtrace_fd = -1;
+
+static uint8_t mtrace_buf[MTRACE_BUF_SIZE];
+static int mtrace_buf_len = 0;
+static uint64_t last_inst = 0;
+static uint64_t last_pc = 0, last_addr = 0;
+
+static inline uint8_t* put_varint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) { *p ++ = v | 0x80; v >>= 7; }
+  *p ++ = v;
+  return p;
+}
+
+static inline uint8_t* put_zigzag(uint8_t *p, uint64_t delta) {
+  return put_varint(p, (delta << 1) ^ (uint64_t)((int64_t)delta >> 63));
+}
+
+void mtrace_flush() {
+  uint8_t *p = mtrace_buf;
+  while (mtrace_buf_len > 0) {
+    ssize_t ret = write(mtrace_fd, p, mtrace_buf_len);
+    if (ret <= 0) break;
+    p += ret;
+    mtrace_buf_len -= ret;
+  }
+  mtrace_buf_len = 0;
+}
+
+// a forked child stops tracing, the trace file belongs to the parent
+void mtrace_fork_child() {
+  mtrace_enable = false;
+  mtrace_buf_len = 0;
+  if (mtrace_fd >= 0) close(mtrace_fd);
+  mtrace_fd = -1;
+}
+
+void mtrace_record(paddr_t addr, int len, word_t data, bool is_write) {
+  if (mtrace_mmio_only && in_pmem(addr)) return;
+
+  extern uint64_t g_nr_guest_inst;
+  uint8_t *p = mtrace_buf + mtrace_buf_len;
+  bool same_pc = (cpu.pc == last_pc);
+  *p ++ = is_write | (__builtin_ctz(len) << 1) | (same_pc << 3);
+  p = put_varint(p, g_nr_guest_inst - last_inst);
+  if (!same_pc) p = put_zigzag(p, (uint64_t)cpu.pc - last_pc);
+  p = put_zigzag(p, (uint64_t)addr - last_addr);
+  p = put_varint(p, (len < 8 ? (uint64_t)data & ((1ull << (len * 8)) - 1) : (uint64_t)data));
+  last_inst = g_nr_guest_inst;
+  last_pc = cpu.pc;
+  last_addr = addr;
+
+  mtrace_buf_len = p - mtrace_buf;
+  if (mtrace_buf_len > MTRACE_BUF_SIZE - MTRACE_RECORD_MAX) mtrace_flush();
+}
+
+/* `range` is "LOW:HIGH" and overrides CONFIG_MTRACE_RANGE_*,
+ * nothing is traced if `file` is NULL.
+ */
+void init_mtrace(const char *file, const char *range, bool mmio_only) {
+  if (file == NULL) return;
+
+  mtrace_low = CONFIG_MTRACE_RANGE_LOW;
+  mtrace_high = CONFIG_MTRACE_RANGE_HIGH;
+  if (range != NULL) {
+    char *end;
+    mtrace_low = strtoull(range, &end, 0);
+    Assert(*end == ':', "invalid mtrace range '%s', should be LOW:HIGH", range);
+    mtrace_high = strtoull(end + 1, &end, 0);
+    Assert(*end == '\0' && mtrace_low <= mtrace_high, "invalid mtrace range '%s'", range);
+  }
+  mtrace_mmio_only = mmio_only || ISDEF(CONFIG_MTRACE_MMIO_ONLY);
+
+  mtrace_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  Assert(mtrace_fd != -1, "Can not open '%s'", file);
+  memcpy(mtrace_buf, "NEMUMTR", 7);
+  mtrace_buf[7] = MTRACE_VERSION;
+  mtrace_buf_len = 8;
+  atexit(mtrace_flush);
+  mtrace_enable = true;
+
+  Log("Memory trace is written to %s, range = [" FMT_PADDR ", " FMT_PADDR "]%s",
+      file, mtrace_low, mtrace_high, mtrace_mmio_only ? ", MMIO only" : "");
+}
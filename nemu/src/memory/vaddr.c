@@ -14,16 +14,171 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/mtrace.h>
+#ifdef CONFIG_DECODE_CACHE
+#include <cpu/decode-cache.h>
+#endif
+
+/* isa_mmu_translate() returns the physical address of the page
+ * with one of MEM_RET_* in the page offset.
+ */
+static paddr_t mmu_translate(vaddr_t vaddr, int len, int type) {
+  paddr_t ret = isa_mmu_translate(vaddr, len, type);
+  Assert((ret & PAGE_MASK) == MEM_RET_OK, "address translation failed at vaddr = " FMT_WORD
+      ", type = %d, pc = " FMT_WORD, vaddr, type, cpu.pc);
+  return (ret & ~(paddr_t)PAGE_MASK) | (vaddr & PAGE_MASK);
+}
+
+#ifdef CONFIG_TLB
+static_assert((CONFIG_TLB_SIZE & (CONFIG_TLB_SIZE - 1)) == 0,
+    "CONFIG_TLB_SIZE must be a power of 2");
+
+#define NR_TLB 3 // one for each of MEM_TYPE_IFETCH, MEM_TYPE_READ and MEM_TYPE_WRITE
+#define TLB_INVALID ((vaddr_t)-1)
+
+typedef struct {
+  vaddr_t vpn;     // tag
+  paddr_t ppage;   // physical address of the page
+  uint8_t *hpage;  // host address of the page
+} TLBEntry;
+
+static TLBEntry tlb[NR_TLB][CONFIG_TLB_SIZE] = {
+  [0 ... NR_TLB - 1] = { [0 ... CONFIG_TLB_SIZE - 1] = { .vpn = TLB_INVALID } }
+};
+static uint64_t tlb_hit[NR_TLB] = {}, tlb_miss[NR_TLB] = {};
+
+static inline TLBEntry* tlb_entry(vaddr_t vaddr, int type) {
+  return &tlb[type][(vaddr >> PAGE_SHIFT) & (CONFIG_TLB_SIZE - 1)];
+}
+
+// an access is served by the TLB only if it does not cross the page
+static inline bool tlb_match(TLBEntry *e, vaddr_t vaddr, int len) {
+  return e->vpn == (vaddr >> PAGE_SHIFT) && (vaddr & PAGE_MASK) <= PAGE_SIZE - len;
+}
+
+static paddr_t tlb_refill(TLBEntry *e, vaddr_t vaddr, int len, int type) {
+  paddr_t paddr = mmu_translate(vaddr, len, type);
+  paddr_t ppage = paddr & ~(paddr_t)PAGE_MASK;
+  // pages of devices are always translated again, and accessed through mmio
+  if (in_pmem(ppage) && in_pmem(ppage + PAGE_SIZE - 1)) {
+    *e = (TLBEntry) { .vpn = vaddr >> PAGE_SHIFT, .ppage = ppage, .hpage = guest_to_host(ppage) };
+  }
+  return paddr;
+}
+
+// should be called when the mapping changes, e.g. on writing satp and sfence.vma
+void tlb_flush() {
+  for (int t = 0; t < NR_TLB; t ++) {
+    for (int i = 0; i < CONFIG_TLB_SIZE; i ++) tlb[t][i].vpn = TLB_INVALID;
+  }
+  // decoded and translated code is keyed by virtual pc, but only
+  // invalidated by stores to its physical address
+  IFDEF(CONFIG_DECODE_CACHE, decode_cache_flush());
+}
+
+void tlb_statistic() {
+  static const char *name[NR_TLB] = { "ifetch", "read", "write" };
+  for (int t = 0; t < NR_TLB; t ++) {
+    uint64_t total = tlb_hit[t] + tlb_miss[t];
+    if (total == 0) continue;
+    Log("%s tlb: hit = %" PRIu64 ", miss = %" PRIu64 ", hit rate = %.2f%%",
+        name[t], tlb_hit[t], tlb_miss[t], 100.0 * tlb_hit[t] / total);
+  }
+}
+#endif
+
+// only data reads are traced and counted, instruction fetches are not
+static inline word_t trace_read(paddr_t paddr, int len, int type, word_t data) {
+  if (type == MEM_TYPE_READ) data_access_hook(paddr, len, data, false);
+  return data;
+}
+
+static inline word_t vaddr_access_read(vaddr_t addr, int len, int type) {
+  int ret = isa_mmu_check(addr, len, type);
+  if (likely(ret == MMU_DIRECT)) return trace_read(addr, len, type, paddr_read(addr, len));
+  Assert(ret == MMU_TRANSLATE, "address check failed at vaddr = " FMT_WORD, addr);
+  paddr_t paddr;
+#ifdef CONFIG_TLB
+  TLBEntry *e = tlb_entry(addr, type);
+  if (likely(tlb_match(e, addr, len))) {
+    tlb_hit[type] ++;
+    return trace_read(e->ppage | (addr & PAGE_MASK), len, type,
+        host_read(e->hpage + (addr & PAGE_MASK), len));
+  }
+  tlb_miss[type] ++;
+  paddr = tlb_refill(e, addr, len, type);
+#else
+  paddr = mmu_translate(addr, len, type);
+#endif
+  return trace_read(paddr, len, type, paddr_read(paddr, len));
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  return vaddr_access_read(addr, len, MEM_TYPE_IFETCH);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  return vaddr_access_read(addr, len, MEM_TYPE_READ);
+}
+
+static bool debug_translate(vaddr_t addr, int len, int type, paddr_t *paddr) {
+  *paddr = addr;
+  int ret = isa_mmu_check(addr, len, type);
+  if (ret == MMU_FAIL) return false;
+  if (ret == MMU_TRANSLATE) {
+    // the TLB is bypassed, so that it is not refilled by the debugger
+    paddr_t pg = isa_mmu_translate(addr, len, type);
+    if ((pg & PAGE_MASK) != MEM_RET_OK) return false;
+    *paddr = (pg & ~(paddr_t)PAGE_MASK) | (addr & PAGE_MASK);
+  }
+  // accessing device registers may invoke their callbacks
+  return in_pmem(*paddr) && in_pmem(*paddr + len - 1);
+}
+
+bool vaddr_debug_read(vaddr_t addr, int len, word_t *data) {
+  paddr_t paddr;
+  if (!debug_translate(addr, len, MEM_TYPE_READ, &paddr)) return false;
+  *data = host_read(guest_to_host(paddr), len);
+  return true;
+}
+
+bool vaddr_debug_write(vaddr_t addr, int len, word_t data) {
+  paddr_t paddr;
+  if (!debug_translate(addr, len, MEM_TYPE_WRITE, &paddr)) return false;
+  // the code there may have been decoded
+  IFDEF(CONFIG_DECODE_CACHE, decode_cache_check_write(paddr, len));
+  host_write(guest_to_host(paddr), len, data);
+  return true;
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  wp_check_store(addr, len);
+  int ret = isa_mmu_check(addr, len, MEM_TYPE_WRITE);
+  if (likely(ret == MMU_DIRECT)) {
+    data_access_hook(addr, len, data, true);
+    paddr_write(addr, len, data);
+    return;
+  }
+  Assert(ret == MMU_TRANSLATE, "address check failed at vaddr = " FMT_WORD, addr);
+  paddr_t paddr;
+#ifdef CONFIG_TLB
+  TLBEntry *e = tlb_entry(addr, MEM_TYPE_WRITE);
+  if (likely(tlb_match(e, addr, len))) {
+    tlb_hit[MEM_TYPE_WRITE] ++;
+    paddr = e->ppage | (addr & PAGE_MASK);
+    data_access_hook(paddr, len, data, true);
+    IFDEF(CONFIG_DECODE_CACHE, decode_cache_check_write(paddr, len));
+    host_write(e->hpage + (addr & PAGE_MASK), len, data);
+    return;
+  }
+  tlb_miss[MEM_TYPE_WRITE] ++;
+  paddr = tlb_refill(e, addr, len, MEM_TYPE_WRITE);
+#else
+  paddr = mmu_translate(addr, len, MEM_TYPE_WRITE);
+#endif
+  data_access_hook(paddr, len, data, true);
+  paddr_write(paddr, len, data);
 }
@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <memory/mtrace.h>
 
 void init_rand();
 void init_log(const char *log_file);
@@ -44,7 +45,22 @@ void sdb_set_batch_mode();
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *elf_file = NULL;
 static int difftest_port = 1234;
+#ifdef CONFIG_FTRACE
+static char *ftrace_folded_file = NULL;
+#endif
+#ifdef CONFIG_PROFILE
+static char *profile_folded_file = NULL;
+#endif
+#ifdef CONFIG_CHECKPOINT
+static char *restore_file = NULL;
+#endif
+#ifdef CONFIG_MTRACE
+static char *mtrace_file = NULL;
+static char *mtrace_range = NULL;
+static bool mtrace_mmio = false;
+#endif
 
 static long load_img() {
   if (img_file == NULL) {
@@ -74,16 +90,46 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"elf"      , required_argument, NULL, 'e'},
     {"help"     , no_argument      , NULL, 'h'},
+#ifdef CONFIG_FTRACE
+    {"ftrace-folded", required_argument, NULL, 'F'},
+#endif
+#ifdef CONFIG_PROFILE
+    {"profile-folded", required_argument, NULL, 'P'},
+#endif
+#ifdef CONFIG_CHECKPOINT
+    {"restore"  , required_argument, NULL, 'r'},
+#endif
+#ifdef CONFIG_MTRACE
+    {"mtrace"      , required_argument, NULL, 'm'},
+    {"mtrace-range", required_argument, NULL, 'R'},
+    {"mtrace-mmio" , no_argument      , NULL, 'M'},
+#endif
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:" MUXDEF(CONFIG_MTRACE, "m:", ""), table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'e': elf_file = optarg; break;
+#ifdef CONFIG_FTRACE
+      case 'F': ftrace_folded_file = optarg; break;
+#endif
+#ifdef CONFIG_PROFILE
+      case 'P': profile_folded_file = optarg; break;
+#endif
+#ifdef CONFIG_CHECKPOINT
+      case 'r': restore_file = optarg; break;
+#endif
+#ifdef CONFIG_MTRACE
+      case 'm': mtrace_file = optarg; break;
+      case 'R': mtrace_range = optarg; break;
+      case 'M': mtrace_mmio = true; break;
+#endif
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -91,6 +137,21 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-e,--elf=FILE           load symbols from the ELF FILE\n");
+#ifdef CONFIG_FTRACE
+        printf("\t--ftrace-folded=FILE    output folded call stacks to FILE\n");
+#endif
+#ifdef CONFIG_PROFILE
+        printf("\t--profile-folded=FILE   output profile counts as folded stacks to FILE\n");
+#endif
+#ifdef CONFIG_CHECKPOINT
+        printf("\t--restore=FILE         restore the machine from the checkpoint FILE\n");
+#endif
+#ifdef CONFIG_MTRACE
+        printf("\t-m,--mtrace=FILE        output memory trace to FILE\n");
+        printf("\t--mtrace-range=LOW:HIGH only trace physical addresses in [LOW, HIGH]\n");
+        printf("\t--mtrace-mmio           only trace accesses outside pmem\n");
+#endif
         printf("\n");
         exit(0);
     }
@@ -113,6 +174,9 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize memory. */
   init_mem();
 
+  /* Open the memory trace. */
+  IFDEF(CONFIG_MTRACE, init_mtrace(mtrace_file, mtrace_range, mtrace_mmio));
+
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
@@ -122,6 +186,16 @@ void init_monitor(int argc, char *argv[]) {
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
+  /* Restore the machine from a checkpoint. */
+#ifdef CONFIG_CHECKPOINT
+  if (restore_file != NULL) Assert(checkpoint_load(restore_file), "Can not restore from '%s'", restore_file);
+#endif
+
+  /* Load the symbols for tracing and profiling. */
+  init_elf(elf_file);
+  IFDEF(CONFIG_FTRACE, init_ftrace(elf_file, ftrace_folded_file));
+  IFDEF(CONFIG_PROFILE, init_profile(profile_folded_file));
+
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
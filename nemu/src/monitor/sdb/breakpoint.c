@@ -0,0 +1,156 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/breakpoint.h>
+#include <memory/paddr.h>
+#ifdef CONFIG_DECODE_CACHE
+#include <cpu/decode-cache.h>
+#endif
+#include "sdb.h"
+
+#define NR_BP 32
+#define BP_SET_SIZE 64 // power of 2, larger than NR_BP
+#define BP_SET_EMPTY ((vaddr_t)-1)
+
+typedef struct breakpoint {
+  int NO;
+  struct breakpoint *next;
+
+  vaddr_t addr;
+  char *cond;       // NULL if the breakpoint is unconditional
+  Expr *code;       // compiled from `cond`
+  bool temp;        // deleted after it is hit
+  uint64_t nr_hit;
+} BP;
+
+static BP bp_pool[NR_BP] = {};
+static BP *head = NULL, *free_ = NULL;
+
+// open addressing hash set of the addresses of all breakpoints
+static vaddr_t bp_set[BP_SET_SIZE] = {};
+int bp_nr = 0;
+
+static inline uint32_t bp_hash(vaddr_t pc) {
+  return ((uint32_t)(pc >> 1) * 2654435761u) >> (32 - 6);
+}
+static_assert(BP_SET_SIZE == 1 << 6, "BP_SET_SIZE does not match bp_hash()");
+
+void init_bp_pool() {
+  int i;
+  for (i = 0; i < NR_BP; i ++) {
+    bp_pool[i].NO = i;
+    bp_pool[i].next = (i == NR_BP - 1 ? NULL : &bp_pool[i + 1]);
+  }
+
+  head = NULL;
+  free_ = bp_pool;
+  for (i = 0; i < BP_SET_SIZE; i ++) bp_set[i] = BP_SET_EMPTY;
+}
+
+bool bp_find(vaddr_t pc) {
+  for (uint32_t i = bp_hash(pc); bp_set[i] != BP_SET_EMPTY; i = (i + 1) & (BP_SET_SIZE - 1)) {
+    if (bp_set[i] == pc) return true;
+  }
+  return false;
+}
+
+static void update_set() {
+  bp_nr = 0;
+  for (int i = 0; i < BP_SET_SIZE; i ++) bp_set[i] = BP_SET_EMPTY;
+  for (BP *b = head; b != NULL; b = b->next) {
+    bp_nr ++;
+    uint32_t i = bp_hash(b->addr);
+    while (bp_set[i] != BP_SET_EMPTY && bp_set[i] != b->addr) i = (i + 1) & (BP_SET_SIZE - 1);
+    bp_set[i] = b->addr;
+  }
+}
+
+void bp_set_at(vaddr_t addr, char *cond, bool temp) {
+  if (free_ == NULL) {
+    printf("Too many breakpoints\n");
+    return;
+  }
+  Expr *x = NULL;
+  if (cond != NULL && (x = expr_compile(cond)) == NULL) return;
+
+  BP *b = free_;
+  free_ = b->next;
+  b->addr = addr;
+  b->cond = (cond != NULL ? strdup(cond) : NULL);
+  b->code = x;
+  b->temp = temp;
+  b->nr_hit = 0;
+  b->next = NULL;
+  BP **p = &head;
+  while (*p != NULL) p = &(*p)->next;
+  *p = b;
+  update_set();
+  // throw away the cached decoding result and blocks containing it
+  IFDEF(CONFIG_DECODE_CACHE, if (in_pmem(addr)) decode_cache_invalidate(addr));
+
+  printf("%s %d at " FMT_WORD "\n", (temp ? "Temporary breakpoint" : "Breakpoint"), b->NO, addr);
+}
+
+bool bp_delete(int NO) {
+  for (BP **p = &head; *p != NULL; p = &(*p)->next) {
+    BP *b = *p;
+    if (b->NO != NO) continue;
+    *p = b->next;
+    free(b->cond);
+    expr_free(b->code);
+    b->cond = NULL;
+    b->code = NULL;
+    b->next = free_;
+    free_ = b;
+    update_set();
+    return true;
+  }
+  return false;
+}
+
+void bp_display() {
+  if (head == NULL) {
+    printf("No breakpoints\n");
+    return;
+  }
+  printf("Num  Type  Address    Hits       Condition\n");
+  for (BP *b = head; b != NULL; b = b->next) {
+    printf("%-4d %-5s " FMT_WORD " %-10" PRIu64 " %s\n", b->NO, (b->temp ? "temp" : "keep"),
+        b->addr, b->nr_hit, (b->cond != NULL ? b->cond : ""));
+  }
+}
+
+// called before executing the instruction at `pc`, which is a breakpoint
+void bp_hit(vaddr_t pc) {
+  // a watchpoint may have stopped the CPU at the same time,
+  // but nothing is hit after the program has ended
+  if (nemu_state.state != NEMU_RUNNING && nemu_state.state != NEMU_STOP) return;
+  BP *next;
+  for (BP *b = head; b != NULL; b = next) {
+    next = b->next;
+    if (b->addr != pc) continue;
+    if (b->code != NULL) {
+      bool success;
+      word_t val = expr_eval(b->code, &success);
+      // stop when the condition can not be evaluated
+      if (success && val == 0) continue;
+    }
+    b->nr_hit ++;
+    nemu_state.state = NEMU_STOP;
+    printf("%s %d at " FMT_WORD "\n", (b->temp ? "Temporary breakpoint" : "Breakpoint"), b->NO, pc);
+    if (b->temp) bp_delete(b->NO);
+  }
+}
@@ -14,112 +14,337 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <memory/vaddr.h>
+#include <ctype.h>
+#include "sdb.h"
 
-/* We use the POSIX regex functions to process regular expressions.
- * Type 'man regex' for more information about POSIX regex functions.
+/* An expression is compiled once into bytecode for a stack machine,
+ * with registers resolved to their host addresses and constant operands
+ * folded. Conditions checked after every instruction are then cheap to
+ * evaluate.
  */
-#include <regex.h>
 
 enum {
-  TK_NOTYPE = 256, TK_EQ,
-
-  /* TODO: Add more token types */
-
+  TK_END = 256, TK_EQ, TK_NEQ, TK_LE, TK_GE, TK_AND, TK_OR,
+  TK_NUM, TK_REG,
 };
 
-static struct rule {
-  const char *regex;
-  int token_type;
-} rules[] = {
+enum {
+  OP_IMM, OP_REG, OP_REG_NAME, OP_DEREF, OP_NEG, OP_NOT,
+  OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_EQ, OP_NEQ, OP_LT, OP_GT, OP_LE, OP_GE,
+  OP_JZ,   // for '&&', leave 0 and jump if the top is 0, otherwise pop it
+  OP_JNZ,  // for '||', leave 1 and jump if the top is not 0, otherwise pop it
+};
 
-  /* TODO: Add more rules.
-   * Pay attention to the precedence level of different rules.
-   */
+typedef struct {
+  int op;
+  int gpr;                  // index of the register of OP_REG, or -1
+  union {
+    word_t imm;
+    const word_t *reg;
+    char name[8];           // register which is not a whole word, such as x86 `al`
+    int target;             // of OP_JZ and OP_JNZ
+  };
+} ExprOp;
 
-  {" +", TK_NOTYPE},    // spaces
-  {"\\+", '+'},         // plus
-  {"==", TK_EQ},        // equal
+struct Expr {
+  int nr_op;
+  int max_stack;
+  ExprOp op[];
 };
 
-#define NR_REGEX ARRLEN(rules)
+// --- scanner ---
+static struct {
+  const char *e, *p;
+  int type;           // the current token
+  const char *start;  // where the current token starts
+  word_t num;
+  char name[32];
+  bool ok;
+} sc;
 
-static regex_t re[NR_REGEX] = {};
+static void error(const char *msg) {
+  if (!sc.ok) return;
+  int pos = sc.start - sc.e;
+  printf("%s at position %d\n%s\n%*.s^\n", msg, pos, sc.e, pos, "");
+  sc.ok = false;
+}
 
-/* Rules are used for many times.
- * Therefore we compile them only once before any usage.
- */
-void init_regex() {
-  int i;
-  char error_msg[128];
-  int ret;
-
-  for (i = 0; i < NR_REGEX; i ++) {
-    ret = regcomp(&re[i], rules[i].regex, REG_EXTENDED);
-    if (ret != 0) {
-      regerror(ret, &re[i], error_msg, 128);
-      panic("regex compilation failed: %s\n%s", error_msg, rules[i].regex);
+static void next_token() {
+  const char *p = sc.p;
+  while (*p == ' ' || *p == '\t') p ++;
+  sc.start = p;
+  char c = *p;
+  if (c == '\0') { sc.type = TK_END; sc.p = p; return; }
+
+  if (c >= '0' && c <= '9') {
+    char *end;
+    bool hex = (c == '0' && (p[1] | 0x20) == 'x');
+    sc.num = strtoull(p, &end, hex ? 16 : 10);
+    sc.type = TK_NUM;
+    sc.p = end;
+    return;
+  }
+  if (c == '$') {
+    int n = 0;
+    for (p ++; isalnum((unsigned char)*p); p ++) {
+      if (n < sizeof(sc.name) - 1) sc.name[n ++] = *p;
+    }
+    sc.name[n] = '\0';
+    sc.type = TK_REG;
+    sc.p = p;
+    return;
+  }
+
+  static const struct { char s[3]; int type; } op2[] = {
+    { "==", TK_EQ }, { "!=", TK_NEQ }, { "<=", TK_LE }, { ">=", TK_GE },
+    { "&&", TK_AND }, { "||", TK_OR },
+  };
+  for (int i = 0; i < ARRLEN(op2); i ++) {
+    if (c == op2[i].s[0] && p[1] == op2[i].s[1]) {
+      sc.type = op2[i].type;
+      sc.p = p + 2;
+      return;
     }
   }
+  if (strchr("+-*/()!<>", c) != NULL) {
+    sc.type = c;
+    sc.p = p + 1;
+    return;
+  }
+  sc.type = TK_END;
+  error("unexpected character");
 }
 
-typedef struct token {
-  int type;
-  char str[32];
-} Token;
+// --- compiler ---
+static ExprOp *code = NULL;
+static int nr_code = 0, max_code = 0;
+static int depth = 0, max_depth = 0; // of the stack when the code is run
 
-static Token tokens[32] __attribute__((used)) = {};
-static int nr_token __attribute__((used))  = 0;
+static ExprOp* emit(int op, int push) {
+  if (nr_code == max_code) {
+    max_code = (max_code == 0 ? 16 : max_code * 2);
+    code = realloc(code, sizeof(ExprOp) * max_code);
+    assert(code != NULL);
+  }
+  depth += push;
+  if (depth > max_depth) max_depth = depth;
+  ExprOp *o = &code[nr_code ++];
+  o->op = op;
+  o->gpr = -1;
+  return o;
+}
 
-static bool make_token(char *e) {
-  int position = 0;
-  int i;
-  regmatch_t pmatch;
+static void emit_imm(word_t imm) { emit(OP_IMM, 1)->imm = imm; }
 
-  nr_token = 0;
+static bool is_imm(int i) { return i >= 0 && code[i].op == OP_IMM; }
 
-  while (e[position] != '\0') {
-    /* Try all rules one by one. */
-    for (i = 0; i < NR_REGEX; i ++) {
-      if (regexec(&re[i], e + position, 1, &pmatch, 0) == 0 && pmatch.rm_so == 0) {
-        char *substr_start = e + position;
-        int substr_len = pmatch.rm_eo;
+static word_t calc_unary(int op, word_t x) {
+  switch (op) {
+    case OP_NEG: return -x;
+    case OP_NOT: return !x;
+    default: panic("bad unary op %d", op);
+  }
+}
 
-        Log("match rules[%d] = \"%s\" at position %d with len %d: %.*s",
-            i, rules[i].regex, position, substr_len, substr_len, substr_start);
+// division by zero is checked by the caller
+static word_t calc_binary(int op, word_t x, word_t y) {
+  switch (op) {
+    case OP_ADD: return x + y;
+    case OP_SUB: return x - y;
+    case OP_MUL: return x * y;
+    case OP_DIV: return x / y;
+    case OP_EQ:  return x == y;
+    case OP_NEQ: return x != y;
+    case OP_LT:  return x < y;
+    case OP_GT:  return x > y;
+    case OP_LE:  return x <= y;
+    case OP_GE:  return x >= y;
+    default: panic("bad binary op %d", op);
+  }
+}
 
-        position += substr_len;
+static void compile_binary(int prec);
 
-        /* TODO: Now a new token is recognized with rules[i]. Add codes
-         * to record the token in the array `tokens'. For certain types
-         * of tokens, some extra actions should be performed.
-         */
+static void compile_reg(const char *name) {
+  const word_t *reg = isa_reg_addr(name);
+  if (reg != NULL) {
+    ExprOp *o = emit(OP_REG, 1);
+    o->reg = reg;
+    o->gpr = isa_gpr_idx(name);
+    return;
+  }
+  bool success = false;
+  isa_reg_str2val(name, &success);
+  if (!success || strlen(name) >= sizeof(code[0].name)) { error("unknown register"); return; }
+  strcpy(emit(OP_REG_NAME, 1)->name, name);
+}
 
-        switch (rules[i].token_type) {
-          default: TODO();
-        }
+static void compile_unary() {
+  int type = sc.type;
+  if (type == TK_NUM) { emit_imm(sc.num); next_token(); return; }
+  if (type == TK_REG) { compile_reg(sc.name); next_token(); return; }
+  if (type != '(' && type != '-' && type != '!' && type != '*') { error("expect an operand"); return; }
+  next_token();
+  if (type == '(') {
+    compile_binary(1);
+    if (sc.type != ')') { error("expect ')'"); return; }
+    next_token();
+    return;
+  }
 
-        break;
-      }
-    }
+  int op = (type == '-' ? OP_NEG : type == '!' ? OP_NOT : OP_DEREF);
+  compile_unary();
+  if (!sc.ok) return;
+  if (op != OP_DEREF && is_imm(nr_code - 1)) {
+    code[nr_code - 1].imm = calc_unary(op, code[nr_code - 1].imm);
+    return;
+  }
+  emit(op, 0);
+}
+
+static int binary_op(int type, int *prec) {
+  switch (type) {
+    case TK_OR:  *prec = 1; return OP_JNZ;
+    case TK_AND: *prec = 2; return OP_JZ;
+    case TK_EQ:  *prec = 3; return OP_EQ;
+    case TK_NEQ: *prec = 3; return OP_NEQ;
+    case '<':    *prec = 4; return OP_LT;
+    case '>':    *prec = 4; return OP_GT;
+    case TK_LE:  *prec = 4; return OP_LE;
+    case TK_GE:  *prec = 4; return OP_GE;
+    case '+':    *prec = 5; return OP_ADD;
+    case '-':    *prec = 5; return OP_SUB;
+    case '*':    *prec = 6; return OP_MUL;
+    case '/':    *prec = 6; return OP_DIV;
+    default:     *prec = 0; return -1;
+  }
+}
 
-    if (i == NR_REGEX) {
-      printf("no match at position %d\n%s\n%*.s^\n", position, e, position, "");
-      return false;
+static void compile_binary(int prec) {
+  compile_unary();
+  while (sc.ok) {
+    int p, op = binary_op(sc.type, &p);
+    if (p < prec || p == 0) break;
+    next_token();
+    int lhs = nr_code - 1;
+    if (op == OP_JZ || op == OP_JNZ) {
+      int jmp = nr_code;
+      emit(op, -1);
+      compile_binary(p + 1);
+      code[jmp].target = nr_code;
+      emit(OP_NOT, 0);  // normalize the result to 0 or 1
+      emit(OP_NOT, 0);
+      continue;
     }
+    compile_binary(p + 1);
+    if (!sc.ok) break;
+    int rhs = nr_code - 1;
+    if (is_imm(lhs) && rhs == lhs + 1 && is_imm(rhs) && !(op == OP_DIV && code[rhs].imm == 0)) {
+      code[lhs].imm = calc_binary(op, code[lhs].imm, code[rhs].imm);
+      nr_code --;
+      depth --;
+      continue;
+    }
+    emit(op, -1);
   }
+}
 
-  return true;
+Expr* expr_compile(const char *e) {
+  sc.e = sc.p = e;
+  sc.ok = true;
+  nr_code = depth = max_depth = 0;
+  next_token();
+  if (sc.type == TK_END) error("empty expression");
+  else {
+    compile_binary(1);
+    if (sc.type != TK_END) error("unexpected token");
+  }
+  if (!sc.ok) return NULL;
+
+  Expr *x = malloc(sizeof(Expr) + sizeof(ExprOp) * nr_code);
+  assert(x != NULL);
+  x->nr_op = nr_code;
+  x->max_stack = max_depth;
+  memcpy(x->op, code, sizeof(ExprOp) * nr_code);
+  return x;
+}
+
+void expr_free(Expr *x) {
+  free(x);
 }
 
+// the reason why the last evaluation failed
+static char eval_error[64] = "";
+
+word_t expr_eval(const Expr *x, bool *success) {
+  word_t stack[x->max_stack];
+  int sp = -1;
+  const ExprOp *o = x->op, *end = x->op + x->nr_op;
+  *success = true;
+  while (o < end) {
+    switch (o->op) {
+      case OP_IMM: stack[++ sp] = o->imm; break;
+      case OP_REG: stack[++ sp] = *o->reg; break;
+      case OP_REG_NAME: stack[++ sp] = isa_reg_str2val(o->name, success); break;
+      case OP_DEREF:
+        if (!vaddr_debug_read(stack[sp], sizeof(word_t), &stack[sp])) {
+          snprintf(eval_error, sizeof(eval_error), "can not access memory at " FMT_WORD, stack[sp]);
+          *success = false;
+          return 0;
+        }
+        break;
+      case OP_NEG: stack[sp] = -stack[sp]; break;
+      case OP_NOT: stack[sp] = !stack[sp]; break;
+      case OP_JZ:
+        if (stack[sp] == 0) { o = x->op + o->target; continue; }
+        sp --;
+        break;
+      case OP_JNZ:
+        if (stack[sp] != 0) { o = x->op + o->target; continue; }
+        sp --;
+        break;
+      case OP_DIV:
+        if (stack[sp] == 0) {
+          strcpy(eval_error, "division by zero");
+          *success = false;
+          return 0;
+        }
+        // fall through
+      default:
+        sp --;
+        stack[sp] = calc_binary(o->op, stack[sp], stack[sp + 1]);
+        break;
+    }
+    o ++;
+  }
+  return stack[0];
+}
 
 word_t expr(char *e, bool *success) {
-  if (!make_token(e)) {
+  Expr *x = expr_compile(e);
+  if (x == NULL) {
     *success = false;
     return 0;
   }
+  word_t val = expr_eval(x, success);
+  if (!*success) printf("%s\n", eval_error);
+  expr_free(x);
+  return val;
+}
 
-  /* TODO: Insert codes to evaluate the expression. */
-  TODO();
-
-  return 0;
+/* Tell how a watchpoint on `x` can be triggered:
+ * `$reg` changes only when the register is written, and `*ADDR` with a
+ * constant address changes only when the word at ADDR is stored to.
+ */
+int expr_watch_kind(const Expr *x, vaddr_t *addr, int *reg) {
+  if (x->nr_op == 1 && x->op[0].op == OP_REG && x->op[0].gpr >= 0) {
+    *reg = x->op[0].gpr;
+    return WATCH_REG;
+  }
+  if (x->nr_op == 2 && x->op[0].op == OP_IMM && x->op[1].op == OP_DEREF) {
+    *addr = x->op[0].imm;
+    return WATCH_MEM;
+  }
+  return WATCH_EXPR;
 }
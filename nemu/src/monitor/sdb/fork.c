@@ -0,0 +1,136 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/mtrace.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "sdb.h"
+
+void sdb_set_batch_mode();
+void sdb_mainloop();
+void log_flush();
+void log_fork_child();
+void device_fork_child();
+int is_exit_status_bad();
+
+extern uint64_t g_nr_guest_inst;
+
+/* The child runs the commands in `script`, and then continues
+ * to the end as in batch mode. The machine is a copy-on-write
+ * snapshot of the parent at the time of fork(). The trace files
+ * belong to the parent, so the child detaches from them and leaves
+ * with _exit(), which skips the atexit() handlers flushing them.
+ */
+static void run_child(const char *script, int fd) {
+  log_fork_child();
+  IFDEF(CONFIG_MTRACE, mtrace_fork_child());
+  IFDEF(CONFIG_FTRACE, ftrace_fork_child());
+  IFDEF(CONFIG_PROFILE, profile_fork_child());
+  IFDEF(CONFIG_DEVICE, device_fork_child());
+  sdb_set_batch_mode();
+  uint64_t start = g_nr_guest_inst;
+
+  bool quit = false;
+  if (script != NULL) {
+    FILE *fp = fopen(script, "r");
+    if (fp == NULL) {
+      printf("Can not open '%s'\n", script);
+      fflush(stdout);
+      _exit(1);
+    }
+    char line[1024];
+    while (!quit && fgets(line, sizeof(line), fp) != NULL) {
+      line[strcspn(line, "\n")] = '\0';
+      quit = (sdb_exec(line) < 0);
+    }
+    fclose(fp);
+  }
+  if (!quit) sdb_mainloop();
+
+  ForkResult r = { .state = nemu_state.state, .halt_ret = nemu_state.halt_ret,
+    .halt_pc = nemu_state.halt_pc, .nr_inst = g_nr_guest_inst - start };
+  int ret = write(fd, &r, sizeof(r));
+  assert(ret == sizeof(r));
+  fflush(stdout);
+  _exit(is_exit_status_bad());
+}
+
+/* Fork a child for each script, and wait for all of them. At most
+ * as many children as the host processors are running at a time.
+ */
+void sdb_fork(int n, char *script[], ForkResult *res) {
+  long max_running = sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_running < 1) max_running = 1;
+  pid_t pid[n];
+  int fd[n];
+  int next = 0, running = 0;
+
+  // buffered output would be written again by every child
+  fflush(stdout);
+  log_flush();
+  IFDEF(CONFIG_MTRACE, mtrace_flush());
+
+  while (next < n || running > 0) {
+    while (next < n && running < max_running) {
+      int pipefd[2];
+      Assert(pipe(pipefd) == 0, "Can not create a pipe");
+      pid[next] = fork();
+      Assert(pid[next] >= 0, "Can not fork");
+      if (pid[next] == 0) {
+        close(pipefd[0]);
+        run_child(script[next], pipefd[1]);
+      }
+      close(pipefd[1]);
+      fd[next ++] = pipefd[0];
+      running ++;
+    }
+
+    int status;
+    pid_t p = wait(&status);
+    if (p < 0) break;
+    int i;
+    for (i = 0; i < next && pid[i] != p; i ++);
+    if (i == next) continue;  // not forked here
+    running --;
+    if (read(fd[i], &res[i], sizeof(res[i])) != sizeof(res[i])) {
+      // nothing is written if the child fails
+      memset(&res[i], 0, sizeof(res[i]));
+      res[i].state = NEMU_ABORT;
+    }
+    res[i].status = (WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status));
+    close(fd[i]);
+  }
+}
+
+void fork_display(int n, char *script[], ForkResult *res) {
+  printf("Child  Exit  Result          Instructions  Script\n");
+  for (int i = 0; i < n; i ++) {
+    ForkResult *r = &res[i];
+    char result[32];
+    switch (r->state) {
+      case NEMU_END:
+        if (r->halt_ret == 0) snprintf(result, sizeof(result), "GOOD TRAP");
+        else snprintf(result, sizeof(result), "BAD TRAP (%u)", r->halt_ret);
+        break;
+      case NEMU_QUIT: snprintf(result, sizeof(result), "QUIT"); break;
+      case NEMU_STOP: snprintf(result, sizeof(result), "STOP"); break;
+      default: snprintf(result, sizeof(result), "ABORT"); break;
+    }
+    printf("%-5d  %-4d  %-14s  %12" PRIu64 "  %s\n", i, r->status, result, r->nr_inst,
+        script[i] != NULL ? script[i] : "-");
+  }
+}
@@ -15,14 +15,16 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <memory/vaddr.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "sdb.h"
 
 static int is_batch_mode = false;
 
-void init_regex();
 void init_wp_pool();
+void init_bp_pool();
 
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 static char* rl_gets() {
@@ -52,6 +54,147 @@ static int cmd_q(char *args) {
   return -1;
 }
 
+static int cmd_p(char *args) {
+  if (args == NULL) {
+    printf("Usage: p EXPR\n");
+    return 0;
+  }
+  bool success;
+  word_t val = expr(args, &success);
+  // the reason of a failure is already reported by expr()
+  if (success) printf(FMT_WORD " (%" PRIu64 ")\n", val, (uint64_t)val);
+  return 0;
+}
+
+static int cmd_w(char *args) {
+  if (args == NULL) printf("Usage: w EXPR\n");
+  else wp_set(args);
+  return 0;
+}
+
+static int cmd_d(char *args) {
+  char *arg = strtok(NULL, " ");
+  if (arg == NULL) {
+    printf("Usage: d N\n");
+    return 0;
+  }
+  int NO = atoi(arg);
+  if (!wp_delete(NO)) printf("No watchpoint number %d\n", NO);
+  return 0;
+}
+
+// b ADDR [if COND]
+static int set_breakpoint(char *args, bool temp) {
+  char *cond = (args != NULL ? strstr(args, " if ") : NULL);
+  if (cond != NULL) {
+    *cond = '\0';
+    cond += 4;
+  }
+  bool success = false;
+  vaddr_t addr = (args != NULL ? expr(args, &success) : 0);
+  if (success) bp_set_at(addr, cond, temp);
+  else printf("Usage: %s ADDR [if COND]\n", (temp ? "tb" : "b"));
+  return 0;
+}
+
+static int cmd_b(char *args) {
+  return set_breakpoint(args, false);
+}
+
+static int cmd_tb(char *args) {
+  return set_breakpoint(args, true);
+}
+
+static int cmd_bd(char *args) {
+  char *arg = strtok(NULL, " ");
+  if (arg == NULL) {
+    printf("Usage: bd N\n");
+    return 0;
+  }
+  int NO = atoi(arg);
+  if (!bp_delete(NO)) printf("No breakpoint number %d\n", NO);
+  return 0;
+}
+
+static int cmd_info(char *args) {
+  char *arg = strtok(NULL, " ");
+  if (arg != NULL && strcmp(arg, "w") == 0) wp_display();
+  else if (arg != NULL && strcmp(arg, "b") == 0) bp_display();
+  else printf("Usage: info w|b\n");
+  return 0;
+}
+
+#ifdef CONFIG_INST_STAT
+static int cmd_stat(char *args) {
+  inst_stat_display();
+  return 0;
+}
+#endif
+
+static int cmd_poke(char *args) {
+  char *addr = strtok(args, " ");
+  char *val = (addr == NULL ? NULL : strtok(NULL, ""));
+  if (val == NULL) {
+    printf("Usage: poke ADDR VALUE\n");
+    return 0;
+  }
+  bool success_addr = false, success_val = false;
+  vaddr_t a = expr(addr, &success_addr);
+  word_t v = expr(val, &success_val);
+  if (success_addr && success_val && !vaddr_debug_write(a, 4, v)) {
+    printf("Can not access memory at " FMT_WORD "\n", a);
+  }
+  return 0;
+}
+
+#ifdef CONFIG_HAS_KEYBOARD
+static int cmd_key(char *args) {
+  bool send_key_name(const char *name);
+  char *arg = strtok(args, " ");
+  if (arg == NULL) printf("Usage: key NAME...\n");
+  for (; arg != NULL; arg = strtok(NULL, " ")) {
+    if (!send_key_name(arg)) printf("Unknown key '%s'\n", arg);
+  }
+  return 0;
+}
+#endif
+
+static int cmd_fork(char *args) {
+  char *script[64];
+  int n = 0;
+  for (char *arg = strtok(args, " "); arg != NULL && n < ARRLEN(script); arg = strtok(NULL, " ")) {
+    script[n ++] = (strcmp(arg, "-") == 0 ? NULL : arg);
+  }
+  if (n == 0) {
+    printf("Usage: fork SCRIPT...\n");
+    return 0;
+  }
+  ForkResult res[n];
+  sdb_fork(n, script, res);
+  fork_display(n, script, res);
+  return 0;
+}
+
+#ifdef CONFIG_CHECKPOINT
+static int cmd_save(char *args) {
+  char *arg = strtok(args, " ");
+  int type = CKPT_FULL;
+  if (arg != NULL && strcmp(arg, "-i") == 0) type = CKPT_INCREMENTAL;
+  else if (arg != NULL && strcmp(arg, "-r") == 0) type = CKPT_RAW;
+  if (type != CKPT_FULL) arg = strtok(NULL, " ");
+  if (arg == NULL) printf("Usage: save [-i|-r] FILE\n");
+  else checkpoint_save(arg, type);
+  return 0;
+}
+
+static int cmd_load(char *args) {
+  char *arg = strtok(args, " ");
+  if (arg == NULL) printf("Usage: load FILE\n");
+  else checkpoint_load(arg);
+  return 0;
+}
+#endif
+
 static int cmd_help(char *args);
 
 static struct {
@@ -62,6 +205,25 @@ static struct {
   { "help", "Display information about all supported commands", cmd_help },
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
+  { "p", "Evaluate the expression EXPR", cmd_p },
+  { "w", "Stop the execution when the value of EXPR changes", cmd_w },
+  { "d", "Delete the watchpoint with number N", cmd_d },
+  { "b", "Stop before executing the instruction at ADDR, with 'b ADDR [if COND]'", cmd_b },
+  { "tb", "Set a breakpoint which is deleted after it is hit", cmd_tb },
+  { "bd", "Delete the breakpoint with number N", cmd_bd },
+  { "info", "Display the watchpoints with 'info w' or the breakpoints with 'info b'", cmd_info },
+#ifdef CONFIG_INST_STAT
+  { "stat", "Display the instruction mix executed so far", cmd_stat },
+#endif
+  { "poke", "Write the 4-byte VALUE to the memory at ADDR, with 'poke ADDR VALUE'", cmd_poke },
+#ifdef CONFIG_HAS_KEYBOARD
+  { "key", "Queue a press and a release of each key NAME, such as 'key A RETURN'", cmd_key },
+#endif
+  { "fork", "Fork a child for each SCRIPT of commands ('-' for none), which continues to the end in parallel", cmd_fork },
+#ifdef CONFIG_CHECKPOINT
+  { "save", "Save a checkpoint of the machine to FILE, only with the pages changed since the last one if '-i' is given, or with uncompressed memory which is restored lazily if '-r' is given", cmd_save },
+  { "load", "Restore the machine from the checkpoint FILE", cmd_load },
+#endif
 
   /* TODO: Add more commands */
 
@@ -96,6 +258,35 @@ void sdb_set_batch_mode() {
   is_batch_mode = true;
 }
 
+/* Execute the command line `str`, return a negative value
+ * if the debugger should exit.
+ */
+int sdb_exec(char *str) {
+  char *str_end = str + strlen(str);
+
+  /* extract the first token as the command */
+  char *cmd = strtok(str, " ");
+  if (cmd == NULL) { return 0; }
+
+  /* treat the remaining string as the arguments,
+   * which may need further parsing
+   */
+  char *args = cmd + strlen(cmd) + 1;
+  if (args >= str_end) {
+    args = NULL;
+  }
+
+  int i;
+  for (i = 0; i < NR_CMD; i ++) {
+    if (strcmp(cmd, cmd_table[i].name) == 0) {
+      return cmd_table[i].handler(args);
+    }
+  }
+
+  printf("Unknown command '%s'\n", cmd);
+  return 0;
+}
+
 void sdb_mainloop() {
   if (is_batch_mode) {
     cmd_c(NULL);
@@ -103,41 +294,19 @@ void sdb_mainloop() {
   }
 
   for (char *str; (str = rl_gets()) != NULL; ) {
-    char *str_end = str + strlen(str);
-
-    /* extract the first token as the command */
-    char *cmd = strtok(str, " ");
-    if (cmd == NULL) { continue; }
-
-    /* treat the remaining string as the arguments,
-     * which may need further parsing
-     */
-    char *args = cmd + strlen(cmd) + 1;
-    if (args >= str_end) {
-      args = NULL;
-    }
-
 #ifdef CONFIG_DEVICE
     extern void sdl_clear_event_queue();
     sdl_clear_event_queue();
 #endif
 
-    int i;
-    for (i = 0; i < NR_CMD; i ++) {
-      if (strcmp(cmd, cmd_table[i].name) == 0) {
-        if (cmd_table[i].handler(args) < 0) { return; }
-        break;
-      }
-    }
-
-    if (i == NR_CMD) { printf("Unknown command '%s'\n", cmd); }
+    if (sdb_exec(str) < 0) { return; }
   }
 }
 
 void init_sdb() {
-  /* Compile the regular expressions. */
-  init_regex();
-
   /* Initialize the watchpoint pool. */
   init_wp_pool();
+
+  /* Initialize the breakpoint pool. */
+  init_bp_pool();
 }
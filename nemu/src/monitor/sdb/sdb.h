@@ -18,6 +18,35 @@
 
 #include <common.h>
 
+typedef struct Expr Expr;
+
+Expr* expr_compile(const char *e);
+word_t expr_eval(const Expr *x, bool *success);
+void expr_free(Expr *x);
 word_t expr(char *e, bool *success);
 
+enum { WATCH_EXPR, WATCH_MEM, WATCH_REG };
+int expr_watch_kind(const Expr *x, vaddr_t *addr, int *reg);
+
+void wp_set(char *e);
+bool wp_delete(int NO);
+void wp_display();
+
+/* Results of a child forked by sdb_fork(). */
+typedef struct {
+  int status;          // exit status, or the negative number of the signal which kills it
+  int state;           // nemu_state.state at the end
+  uint32_t halt_ret;
+  vaddr_t halt_pc;
+  uint64_t nr_inst;    // number of instructions executed after forking
+} ForkResult;
+
+int sdb_exec(char *str);
+void sdb_fork(int n, char *script[], ForkResult *res);
+void fork_display(int n, char *script[], ForkResult *res);
+
+void bp_set_at(vaddr_t addr, char *cond, bool temp);
+bool bp_delete(int NO);
+void bp_display();
+
 #endif
@@ -13,6 +13,7 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#include <cpu/watchpoint.h>
 #include "sdb.h"
 
 #define NR_WP 32
@@ -21,13 +22,23 @@ typedef struct watchpoint {
   int NO;
   struct watchpoint *next;
 
-  /* TODO: Add more members if necessary */
-
+  char *expr;
+  Expr *code;     // compiled from `expr`
+  word_t old_val;
+  int kind;       // one of WATCH_*
+  vaddr_t addr;   // the watched word of WATCH_MEM
+  int reg;        // the watched register of WATCH_REG
+  bool hit;       // the watched word is stored to
 } WP;
 
 static WP wp_pool[NR_WP] = {};
 static WP *head = NULL, *free_ = NULL;
 
+int wp_nr_store = 0;
+uint32_t wp_reg_mask = 0;
+bool wp_pending = false;
+static int wp_nr_expr = 0; // watchpoints evaluated after every instruction
+
 void init_wp_pool() {
   int i;
   for (i = 0; i < NR_WP; i ++) {
@@ -39,5 +50,107 @@ void init_wp_pool() {
   free_ = wp_pool;
 }
 
-/* TODO: Implement the functionality of watchpoint */
+// whether any watchpoint is set, so that instructions should be executed one by one
+bool wp_active() {
+  return head != NULL;
+}
+
+static void update_triggers() {
+  wp_nr_store = wp_nr_expr = 0;
+  wp_reg_mask = 0;
+  for (WP *w = head; w != NULL; w = w->next) {
+    switch (w->kind) {
+      case WATCH_MEM: wp_nr_store ++; break;
+      case WATCH_REG: wp_reg_mask |= 1u << w->reg; break;
+      default: wp_nr_expr ++; break;
+    }
+  }
+  wp_pending = (wp_nr_expr > 0);
+}
+
+void wp_set(char *e) {
+  if (free_ == NULL) {
+    printf("Too many watchpoints\n");
+    return;
+  }
+  Expr *x = expr_compile(e);
+  if (x == NULL) return;
+  bool success;
+  word_t val = expr_eval(x, &success);
+  if (!success) {
+    printf("Can not evaluate '%s'\n", e);
+    expr_free(x);
+    return;
+  }
+
+  WP *w = free_;
+  free_ = w->next;
+  w->expr = strdup(e);
+  w->code = x;
+  w->old_val = val;
+  w->kind = expr_watch_kind(x, &w->addr, &w->reg);
+  w->hit = false;
+  // keep the watchpoints in the order they are set
+  w->next = NULL;
+  WP **p = &head;
+  while (*p != NULL) p = &(*p)->next;
+  *p = w;
+  update_triggers();
+
+  printf("Watchpoint %d: %s\n", w->NO, e);
+}
+
+bool wp_delete(int NO) {
+  for (WP **p = &head; *p != NULL; p = &(*p)->next) {
+    WP *w = *p;
+    if (w->NO != NO) continue;
+    *p = w->next;
+    free(w->expr);
+    expr_free(w->code);
+    w->expr = NULL;
+    w->code = NULL;
+    w->next = free_;
+    free_ = w;
+    update_triggers();
+    return true;
+  }
+  return false;
+}
+
+void wp_display() {
+  if (head == NULL) {
+    printf("No watchpoints\n");
+    return;
+  }
+  static const char *trigger[] = {
+    [WATCH_EXPR] = "every instruction", [WATCH_MEM] = "store", [WATCH_REG] = "register write" };
+  printf("Num  %-18s What\n", "Checked after");
+  for (WP *w = head; w != NULL; w = w->next) {
+    printf("%-4d %-18s %s = " FMT_WORD "\n", w->NO, trigger[w->kind], w->expr, w->old_val);
+  }
+}
+
+void wp_store_hit(vaddr_t addr, int len) {
+  for (WP *w = head; w != NULL; w = w->next) {
+    if (w->kind == WATCH_MEM && addr < w->addr + sizeof(word_t) && w->addr < addr + len) {
+      w->hit = true;
+      wp_pending = true;
+    }
+  }
+}
 
+// called after an instruction which may change some watchpoints
+void wp_check() {
+  for (WP *w = head; w != NULL; w = w->next) {
+    if (w->kind == WATCH_MEM && !w->hit) continue;
+    w->hit = false;
+    bool success;
+    word_t val = expr_eval(w->code, &success);
+    if (!success || val == w->old_val) continue;
+    printf("Watchpoint %d: %s\n\nOld value = " FMT_WORD "\nNew value = " FMT_WORD "\n",
+        w->NO, w->expr, w->old_val, val);
+    w->old_val = val;
+    if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+  }
+  wp_pending = (wp_nr_expr > 0);
+}
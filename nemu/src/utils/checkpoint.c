@@ -0,0 +1,358 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/map.h>
+#ifdef CONFIG_DEVICE
+#include <device/alarm.h>
+#endif
+#include <zlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* A checkpoint starts with the header below, followed by a gzip stream of
+ *   the CPU state (cpu_size bytes),
+ *   the register spaces of all devices (dev_size bytes),
+ *   a bitmap of the pages saved, and the pages themselves.
+ * A full checkpoint saves all non-zero pages. An incremental one saves the
+ * pages changed since `parent`, which is restored first. A raw checkpoint
+ * has no bitmap or pages in the stream, instead the whole memory is stored
+ * uncompressed at `mem_offset`, with zero pages left as holes, and it is
+ * restored by mapping the file into pmem.
+ */
+#define CKPT_MAGIC "NEMUCKPT"
+#define CKPT_VERSION 2
+#define CKPT_FLAG_RAW 0x1
+#define NR_PAGE (CONFIG_MSIZE / PAGE_SIZE)
+#define BITMAP_SIZE ((NR_PAGE + 63) / 64 * sizeof(uint64_t))
+// bound of the parent chain, which also stops a checkpoint naming itself
+#define CKPT_MAX_DEPTH 64
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t page_size;
+  char isa[16];
+  uint64_t mbase, msize;
+  uint32_t cpu_size, dev_size;
+  uint64_t nr_inst;
+  uint64_t nr_skip_inst, alarm_deadline;  // icount mode only
+  uint64_t nr_page;
+  uint32_t flags;
+  uint64_t mem_offset;  // raw checkpoints only
+  char parent[PATH_MAX];
+} CkptHeader;
+
+extern uint64_t g_nr_guest_inst;
+
+// copy of the memory when the last checkpoint is saved or restored, pages
+// which differ from it are dirty for an incremental checkpoint
+static uint8_t *mem_ref = NULL;
+static char last_ckpt[PATH_MAX] = "";
+
+static uint8_t* ref_page(int i) {
+  if (mem_ref == NULL) {
+    // only the pages written take memory
+    mem_ref = mmap(NULL, CONFIG_MSIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    Assert(mem_ref != MAP_FAILED, "Can not allocate the reference memory for checkpoints");
+  }
+  return mem_ref + (uint64_t)i * PAGE_SIZE;
+}
+
+// make page `i` of pmem the reference, return whether it differs from the old one
+static bool update_ref(int i) {
+  uint8_t *p = pmem + (uint64_t)i * PAGE_SIZE, *r = ref_page(i);
+  if (memcmp(p, r, PAGE_SIZE) == 0) return false;
+  memcpy(r, p, PAGE_SIZE);
+  return true;
+}
+
+// the memory of a raw checkpoint is also the reference, which is mapped
+// the same way as pmem so that restoring does not read its pages
+static void map_ref(const char *file, uint64_t offset) {
+  int fd = open(file, O_RDONLY);
+  void *p = (fd < 0 ? MAP_FAILED : mmap(NULL, CONFIG_MSIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_NORESERVE, fd, offset));
+  if (fd >= 0) close(fd);
+  if (p == MAP_FAILED) {
+    for (int i = 0; i < NR_PAGE; i ++) update_ref(i);
+    return;
+  }
+  if (mem_ref != NULL) munmap(mem_ref, CONFIG_MSIZE);
+  mem_ref = p;
+}
+
+static bool page_is_zero(const uint8_t *p) {
+  static const uint8_t zero[PAGE_SIZE] = {};
+  return memcmp(p, zero, PAGE_SIZE) == 0;
+}
+
+static void init_header(CkptHeader *h) {
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, CKPT_MAGIC, sizeof(h->magic));
+  h->version = CKPT_VERSION;
+  h->page_size = PAGE_SIZE;
+  strncpy(h->isa, str(__GUEST_ISA__), sizeof(h->isa) - 1);
+  h->mbase = CONFIG_MBASE;
+  h->msize = CONFIG_MSIZE;
+  h->cpu_size = sizeof(cpu);
+  size_t dev_size = 0;
+  IFDEF(CONFIG_DEVICE, io_space_used(&dev_size));
+  h->dev_size = dev_size;
+}
+
+bool checkpoint_save(const char *file, int type) {
+  bool incremental = (type == CKPT_INCREMENTAL);
+  if (incremental && last_ckpt[0] == '\0') {
+    printf("No checkpoint is saved or restored before\n");
+    return false;
+  }
+  // write a new file and rename it at last, since the old one may be mapped
+  // into pmem by restoring it, and truncating it would break the mapping
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file);
+  int tmp_fd = mkstemp(tmp);
+  FILE *fp = (tmp_fd < 0 ? NULL : fdopen(tmp_fd, "wb"));
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    if (tmp_fd >= 0) { close(tmp_fd); unlink(tmp); }
+    return false;
+  }
+  fchmod(tmp_fd, 0644);
+
+  CkptHeader h;
+  init_header(&h);
+  h.nr_inst = g_nr_guest_inst;
+#ifdef CONFIG_ICOUNT
+  extern uint64_t g_nr_skip_inst;
+  h.nr_skip_inst = g_nr_skip_inst;
+  h.alarm_deadline = alarm_deadline;
+#endif
+  if (incremental) strcpy(h.parent, last_ckpt);
+  if (type == CKPT_RAW) h.flags |= CKPT_FLAG_RAW;
+
+  uint64_t *bitmap = calloc(1, BITMAP_SIZE);
+  assert(bitmap);
+  for (int i = 0; i < NR_PAGE; i ++) {
+    bool changed = update_ref(i);
+    if (incremental ? changed : !page_is_zero(pmem + i * PAGE_SIZE)) {
+      bitmap[i / 64] |= 1ull << (i % 64);
+      h.nr_page ++;
+    }
+  }
+
+  fwrite(&h, sizeof(h), 1, fp);
+  fflush(fp);
+  gzFile gz = gzdopen(dup(fileno(fp)), "wb1");
+  assert(gz);
+  gzwrite(gz, &cpu, sizeof(cpu));
+  if (h.dev_size > 0) gzwrite(gz, MUXDEF(CONFIG_DEVICE, io_space_used(NULL), NULL), h.dev_size);
+  if (type != CKPT_RAW) {
+    gzwrite(gz, bitmap, BITMAP_SIZE);
+    for (int i = 0; i < NR_PAGE; i ++) {
+      if (bitmap[i / 64] & (1ull << (i % 64))) gzwrite(gz, pmem + i * PAGE_SIZE, PAGE_SIZE);
+    }
+  }
+  bool ok = (gzclose(gz) == Z_OK);
+  if (ok && type == CKPT_RAW) {
+    int fd = fileno(fp);
+    h.mem_offset = ROUNDUP(lseek(fd, 0, SEEK_END), PAGE_SIZE);
+    for (int i = 0; ok && i < NR_PAGE; i ++) {
+      uint64_t off = (uint64_t)i * PAGE_SIZE;
+      if (bitmap[i / 64] & (1ull << (i % 64))) ok = pwrite(fd, pmem + off, PAGE_SIZE, h.mem_offset + off) == PAGE_SIZE;
+    }
+    ok = ok && ftruncate(fd, h.mem_offset + CONFIG_MSIZE) == 0;
+    ok = ok && pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+  }
+  ok = (fclose(fp) == 0) && ok;
+  ok = ok && rename(tmp, file) == 0;
+  free(bitmap);
+  if (!ok) {
+    unlink(tmp);
+    printf("Can not write '%s'\n", file);
+    last_ckpt[0] = '\0';
+    return false;
+  }
+
+  if (realpath(file, last_ckpt) == NULL) last_ckpt[0] = '\0';
+  printf("Saved %s checkpoint '%s' with %" PRIu64 " pages\n",
+      (incremental ? "an incremental" : type == CKPT_RAW ? "a raw" : "a full"), file, h.nr_page);
+  return true;
+}
+
+static bool check_header(const char *file, const CkptHeader *h) {
+  CkptHeader ref;
+  init_header(&ref);
+  const char *err = NULL;
+  if (memcmp(h->magic, ref.magic, sizeof(h->magic)) != 0) err = "not a checkpoint";
+  else if (h->version != ref.version) err = "unsupported version";
+  else if (strncmp(h->isa, ref.isa, sizeof(h->isa)) != 0) err = "different ISA";
+  else if (h->page_size != ref.page_size || h->mbase != ref.mbase || h->msize != ref.msize) err = "different memory layout";
+  else if (h->cpu_size != ref.cpu_size || h->dev_size != ref.dev_size) err = "different configuration";
+  if (err != NULL) printf("Can not restore '%s': %s\n", file, err);
+  return err == NULL;
+}
+
+static bool gz_skip(gzFile gz, uint64_t n) {
+  static uint8_t buf[PAGE_SIZE];
+  while (n > 0) {
+    int len = (n < sizeof(buf) ? n : sizeof(buf));
+    if (gzread(gz, buf, len) != len) return false;
+    n -= len;
+  }
+  return true;
+}
+
+/* Read through `file` and its parents without restoring anything, so that
+ * a broken checkpoint is found before the machine is overwritten. The gzip
+ * stream is decompressed to its end, where its checksum is verified.
+ */
+static bool check_file(const char *file, int depth) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+  CkptHeader h;
+  bool ok = (fread(&h, sizeof(h), 1, fp) == 1);
+  if (!ok) printf("Can not restore '%s': truncated\n", file);
+  ok = ok && check_header(file, &h);
+  if (ok && h.parent[0] != '\0') {
+    if (depth < CKPT_MAX_DEPTH) ok = check_file(h.parent, depth + 1);
+    else {
+      printf("Can not restore '%s': too many parents\n", file);
+      ok = false;
+    }
+  }
+  if (!ok) { fclose(fp); return false; }
+
+  bool raw = (h.flags & CKPT_FLAG_RAW);
+  struct stat st;
+  if (raw) ok = fstat(fileno(fp), &st) == 0 && st.st_size >= h.mem_offset + CONFIG_MSIZE;
+  lseek(fileno(fp), sizeof(h), SEEK_SET);
+  gzFile gz = gzdopen(dup(fileno(fp)), "rb");
+  assert(gz);
+  uint64_t *bitmap = calloc(1, BITMAP_SIZE);
+  assert(bitmap);
+  ok = ok && gz_skip(gz, sizeof(cpu) + h.dev_size);
+  if (!raw) ok = ok && gzread(gz, bitmap, BITMAP_SIZE) == BITMAP_SIZE;
+  uint64_t nr_page = 0;
+  for (int i = 0; i < BITMAP_SIZE / sizeof(uint64_t); i ++) nr_page += __builtin_popcountll(bitmap[i]);
+  ok = ok && nr_page == (raw ? 0 : h.nr_page) && gz_skip(gz, nr_page * PAGE_SIZE);
+  // reading past the end checks the trailer, data after the stream is ignored
+  uint8_t c;
+  ok = ok && gzread(gz, &c, 1) == 0;
+  gzclose(gz);
+  fclose(fp);
+  free(bitmap);
+  if (!ok) printf("Can not restore '%s': truncated or corrupted\n", file);
+  return ok;
+}
+
+// pages are read from the file when they are touched for the first time,
+// and copied when they are written
+static bool map_memory(int fd, uint64_t offset) {
+  if (((uintptr_t)pmem & PAGE_MASK) == 0) {
+    return mmap(pmem, CONFIG_MSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) != MAP_FAILED;
+  }
+  // pmem from malloc() may not be page aligned
+  return pread(fd, pmem, CONFIG_MSIZE, offset) == CONFIG_MSIZE;
+}
+
+// the whole chain is checked by check_file() before
+static bool load_file(const char *file, CkptHeader *h_out) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+  CkptHeader h;
+  bool ok = (fread(&h, sizeof(h), 1, fp) == 1);
+  if (!ok) printf("Can not restore '%s': truncated\n", file);
+  ok = ok && check_header(file, &h);
+  bool raw = (h.flags & CKPT_FLAG_RAW);
+  // the parent holds the pages which are not changed since then
+  if (ok && h.parent[0] != '\0') ok = load_file(h.parent, NULL);
+  else if (ok && !raw) memset(pmem, 0, CONFIG_MSIZE);
+  if (ok && raw) ok = map_memory(fileno(fp), h.mem_offset);
+  if (!ok) { fclose(fp); return false; }
+
+  lseek(fileno(fp), sizeof(h), SEEK_SET);
+  gzFile gz = gzdopen(dup(fileno(fp)), "rb");
+  assert(gz);
+  uint64_t *bitmap = malloc(BITMAP_SIZE);
+  assert(bitmap);
+  ok = gzread(gz, &cpu, sizeof(cpu)) == sizeof(cpu);
+  if (h.dev_size > 0) {
+    ok = ok && gzread(gz, MUXDEF(CONFIG_DEVICE, io_space_used(NULL), NULL), h.dev_size) == h.dev_size;
+  }
+  if (raw) memset(bitmap, 0, BITMAP_SIZE);
+  else ok = ok && gzread(gz, bitmap, BITMAP_SIZE) == BITMAP_SIZE;
+  for (int i = 0; ok && i < NR_PAGE; i ++) {
+    if (bitmap[i / 64] & (1ull << (i % 64))) ok = gzread(gz, pmem + i * PAGE_SIZE, PAGE_SIZE) == PAGE_SIZE;
+  }
+  gzclose(gz);
+  fclose(fp);
+  free(bitmap);
+  if (!ok) {
+    printf("Can not restore '%s': truncated\n", file);
+    return false;
+  }
+
+  g_nr_guest_inst = h.nr_inst;
+#ifdef CONFIG_ICOUNT
+  extern uint64_t g_nr_skip_inst;
+  g_nr_skip_inst = h.nr_skip_inst;
+  alarm_deadline = h.alarm_deadline;
+#endif
+  if (h_out != NULL) *h_out = h;
+  return true;
+}
+
+bool checkpoint_load(const char *file) {
+  // a broken checkpoint leaves the machine as it is
+  if (!check_file(file, 0)) return false;
+  CkptHeader h;
+  bool ok = load_file(file, &h);
+  last_ckpt[0] = '\0';
+  if (!ok) return false;
+
+  if (realpath(file, last_ckpt) == NULL) last_ckpt[0] = '\0';
+  if (h.flags & CKPT_FLAG_RAW) map_ref(file, h.mem_offset);
+  else {
+    for (int i = 0; i < NR_PAGE; i ++) update_ref(i);
+  }
+
+  // everything derived from the old memory is stale
+  IFDEF(CONFIG_DECODE_CACHE, decode_cache_flush());
+  IFDEF(CONFIG_TLB, tlb_flush());
+  IFDEF(CONFIG_PROFILE, profile_reset());
+  IFDEF(CONFIG_FTRACE, ftrace_reset());
+#ifdef CONFIG_DEVICE
+  for (int i = 0; i < nr_ram_region; i ++) {
+    RamRegion *r = &ram_region[i];
+    memset(r->dirty, 0xff, (((r->len - 1) >> r->dirty_shift) / 64 + 1) * sizeof(uint64_t));
+  }
+#endif
+  nemu_state.state = NEMU_STOP;
+  printf("Restored checkpoint '%s' at pc = " FMT_WORD "\n", file, cpu.pc);
+  return true;
+}
@@ -16,6 +16,7 @@
 #include <dlfcn.h>
 #include <capstone/capstone.h>
 #include <common.h>
+#include <ctype.h>
 
 static size_t (*cs_disasm_dl)(csh handle, const uint8_t *code,
     size_t code_size, uint64_t address, size_t count, cs_insn **insn);
@@ -59,7 +60,7 @@ void init_disasm() {
 #endif
 }
 
-void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+static void cs_disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
 	cs_insn *insn;
 	size_t count = cs_disasm_dl(handle, code, nbyte, pc, 0, &insn);
   assert(count == 1);
@@ -69,3 +70,83 @@ void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
   }
   cs_free_dl(insn, count);
 }
+
+/* Disassembly results are cached by the instruction encoding. The text
+ * of an instruction with a PC-relative operand, such as a branch target,
+ * depends on the pc. This is detected by disassembling it at another pc,
+ * and such an operand is stored as an offset to the pc, then printed
+ * again on a hit.
+ */
+#define DISASM_CACHE_SIZE 1024
+#define DISASM_TEXT_LEN 96
+
+typedef struct {
+  uint8_t code[16];
+  int nbyte;          // 0 if invalid
+  int rel_start;      // text[rel_start, rel_end) is the PC-relative operand, or -1
+  int rel_end;
+  int64_t offset;     // value of the operand minus pc
+  char text[DISASM_TEXT_LEN];
+} DisasmEntry;
+
+static DisasmEntry disasm_cache[DISASM_CACHE_SIZE] = {};
+static uint64_t disasm_hit = 0, disasm_miss = 0;
+
+static uint32_t disasm_hash(uint8_t *code, int nbyte) {
+  uint32_t h = 2166136261u;
+  int i;
+  for (i = 0; i < nbyte; i ++) h = (h ^ code[i]) * 16777619u;
+  return h % DISASM_CACHE_SIZE;
+}
+
+// find the PC-relative operand by comparing the text disassembled at two pcs
+static bool find_pc_rel(DisasmEntry *e, uint64_t pc, const char *text2, uint64_t pc2) {
+  const char *text = e->text;
+  int i = 0;
+  while (text[i] == text2[i]) {
+    if (text[i] == '\0') { e->rel_start = -1; return true; }
+    i ++;
+  }
+  while (i > 0 && isxdigit((unsigned char)text[i - 1])) i --;
+  if (i < 2 || strncmp(text + i - 2, "0x", 2) != 0) return false;
+  char *end, *end2;
+  uint64_t val = strtoull(text + i, &end, 16);
+  uint64_t val2 = strtoull(text2 + i, &end2, 16);
+  if (strcmp(end, end2) != 0 || val - pc != val2 - pc2) return false;
+  e->rel_start = i - 2;
+  e->rel_end = end - text;
+  e->offset = val - pc;
+  return true;
+}
+
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+  DisasmEntry *e = &disasm_cache[disasm_hash(code, nbyte)];
+  if (e->nbyte == nbyte && memcmp(e->code, code, nbyte) == 0) {
+    disasm_hit ++;
+    if (e->rel_start < 0) snprintf(str, size, "%s", e->text);
+    else snprintf(str, size, "%.*s0x%" PRIx64 "%s", e->rel_start, e->text,
+        (uint64_t)(word_t)(pc + e->offset), e->text + e->rel_end);
+    return;
+  }
+
+  disasm_miss ++;
+  cs_disassemble(str, size, pc, code, nbyte);
+  if (nbyte > sizeof(e->code)) return;
+
+  char text2[DISASM_TEXT_LEN];
+  uint64_t pc2 = pc ^ 0x1000;
+  snprintf(e->text, sizeof(e->text), "%s", str);
+  cs_disassemble(text2, sizeof(text2), pc2, code, nbyte);
+  if (find_pc_rel(e, pc, text2, pc2)) {
+    memcpy(e->code, code, nbyte);
+    e->nbyte = nbyte;
+  } else {
+    e->nbyte = 0;  // can not be cached
+  }
+}
+
+void disasm_statistic() {
+  uint64_t total = disasm_hit + disasm_miss;
+  Log("disasm cache: hit = %" PRIu64 ", miss = %" PRIu64 ", hit rate = %.2f%%",
+      disasm_hit, disasm_miss, total ? 100.0 * disasm_hit / total : 0.0);
+}
@@ -0,0 +1,110 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <elf.h>
+
+/* Function symbols loaded from the ELF file given by --elf,
+ * sorted by address for binary search.
+ */
+typedef struct {
+  vaddr_t addr;
+  uint64_t size;
+  char *name;
+} Symbol;
+
+static Symbol *sym = NULL;
+static int nr_sym = 0;
+
+static int sym_cmp(const void *a, const void *b) {
+  vaddr_t x = ((Symbol *)a)->addr, y = ((Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+#define LOAD_SYMTAB(bits) \
+static void concat(load_symtab, bits)(uint8_t *buf, size_t size) { \
+  Elf##bits##_Ehdr *eh = (void *)buf; \
+  Assert(eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf##bits##_Shdr) <= size, \
+      "invalid section header table"); \
+  Elf##bits##_Shdr *sh = (void *)(buf + eh->e_shoff); \
+  int i, j; \
+  for (i = 0; i < eh->e_shnum; i ++) { \
+    if (sh[i].sh_type != SHT_SYMTAB) continue; \
+    Elf##bits##_Shdr *strsh = &sh[sh[i].sh_link]; \
+    Assert(sh[i].sh_offset + sh[i].sh_size <= size && \
+        strsh->sh_offset + strsh->sh_size <= size, "invalid symbol table"); \
+    Elf##bits##_Sym *st = (void *)(buf + sh[i].sh_offset); \
+    const char *strtab = (const char *)buf + strsh->sh_offset; \
+    int n = sh[i].sh_size / sizeof(*st); \
+    sym = realloc(sym, (nr_sym + n) * sizeof(Symbol)); \
+    assert(sym); \
+    for (j = 0; j < n; j ++) { \
+      if (ELF##bits##_ST_TYPE(st[j].st_info) != STT_FUNC) continue; \
+      if (st[j].st_name >= strsh->sh_size) continue; \
+      sym[nr_sym ++] = (Symbol) { .addr = st[j].st_value, .size = st[j].st_size, \
+        .name = strdup(strtab + st[j].st_name) }; \
+    } \
+  } \
+}
+
+LOAD_SYMTAB(32)
+LOAD_SYMTAB(64)
+
+void init_elf(const char *elf_file) {
+  if (elf_file == NULL) return;
+
+  FILE *fp = fopen(elf_file, "rb");
+  Assert(fp, "Can not open '%s'", elf_file);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(size);
+  assert(buf);
+  int ret = fread(buf, size, 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+
+  Assert(size >= EI_NIDENT && memcmp(buf, ELFMAG, SELFMAG) == 0, "'%s' is not an ELF file", elf_file);
+  if (buf[EI_CLASS] == ELFCLASS64) load_symtab64(buf, size);
+  else load_symtab32(buf, size);
+  free(buf);
+
+  qsort(sym, nr_sym, sizeof(Symbol), sym_cmp);
+  Log("Load %d function symbols from %s", nr_sym, elf_file);
+}
+
+// return the index of the function containing `addr`, or -1
+int elf_symbol_find(vaddr_t addr) {
+  int lo = 0, hi = nr_sym - 1, ret = -1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (sym[mid].addr <= addr) { ret = mid; lo = mid + 1; }
+    else hi = mid - 1;
+  }
+  if (ret == -1) return -1;
+  if (sym[ret].size != 0 && addr - sym[ret].addr >= sym[ret].size) return -1;
+  return ret;
+}
+
+const char* elf_symbol_name(int idx) {
+  return (idx >= 0 ? sym[idx].name : "??");
+}
+
+vaddr_t elf_symbol_addr(int idx) {
+  return sym[idx].addr;
+}
+#endif
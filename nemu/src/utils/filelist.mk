@@ -13,6 +13,25 @@
 # See the Mulan PSL v2 for more details.
 #**************************************************************************************/
 
+LIBS += $(if $(CONFIG_LOG_ASYNC),-lpthread,)
+LIBS += $(if $(CONFIG_CHECKPOINT),-lz,)
+
+ifndef CONFIG_ITRACE
+SRCS-BLACKLIST-y += src/utils/itrace.c
+endif
+
+ifndef CONFIG_FTRACE
+SRCS-BLACKLIST-y += src/utils/ftrace.c
+endif
+
+ifndef CONFIG_PROFILE
+SRCS-BLACKLIST-y += src/utils/profile.c
+endif
+
+ifndef CONFIG_CHECKPOINT
+SRCS-BLACKLIST-y += src/utils/checkpoint.c
+endif
+
 ifeq ($(CONFIG_ITRACE)$(CONFIG_IQUEUE),)
 SRCS-BLACKLIST-y += src/utils/disasm.c
 else
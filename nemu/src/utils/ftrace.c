@@ -0,0 +1,145 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+/* Function calls and returns reported by the ISA are written to the log
+ * as an indented call tree. With --ftrace-folded, the instructions
+ * executed in each call stack are also counted, and written as folded
+ * stacks for flame graph tools at exit.
+ */
+#define FTRACE_MAX_DEPTH 1024
+
+typedef struct {
+  uint64_t hash;
+  int depth;       // 0 if the slot is empty
+  int *frame;
+  uint64_t nr_inst;
+} FoldedStack;
+
+bool ftrace_enable = false;
+
+static int frame[FTRACE_MAX_DEPTH];
+static uint64_t frame_hash[FTRACE_MAX_DEPTH + 1] = { 14695981039346656037ull };
+static int depth = 0;
+static int nr_lost = 0;  // calls beyond FTRACE_MAX_DEPTH
+
+static FILE *folded_fp = NULL;
+static FoldedStack *folded = NULL;
+static uint64_t nr_folded_slot = 0, nr_folded = 0;
+static uint64_t last_inst = 0;
+
+static FoldedStack* folded_find(FoldedStack *tab, uint64_t nr_slot, uint64_t hash, int d, int *f) {
+  uint64_t i = hash & (nr_slot - 1);
+  while (tab[i].depth != 0) {
+    if (tab[i].hash == hash && tab[i].depth == d &&
+        memcmp(tab[i].frame, f, d * sizeof(int)) == 0) break;
+    i = (i + 1) & (nr_slot - 1);
+  }
+  return &tab[i];
+}
+
+// charge the instructions executed since the last event to the current stack
+static void folded_account() {
+  extern uint64_t g_nr_guest_inst;
+  uint64_t nr_inst = g_nr_guest_inst - last_inst;
+  last_inst = g_nr_guest_inst;
+  if (folded_fp == NULL || depth == 0 || nr_inst == 0) return;
+
+  if (nr_folded * 2 >= nr_folded_slot) {
+    uint64_t nr_slot = (nr_folded_slot ? nr_folded_slot * 2 : 1024);
+    FoldedStack *tab = calloc(nr_slot, sizeof(FoldedStack));
+    assert(tab);
+    for (uint64_t i = 0; i < nr_folded_slot; i ++) {
+      FoldedStack *old = &folded[i];
+      if (old->depth != 0) *folded_find(tab, nr_slot, old->hash, old->depth, old->frame) = *old;
+    }
+    free(folded);
+    folded = tab;
+    nr_folded_slot = nr_slot;
+  }
+
+  FoldedStack *s = folded_find(folded, nr_folded_slot, frame_hash[depth], depth, frame);
+  if (s->depth == 0) {
+    s->hash = frame_hash[depth];
+    s->depth = depth;
+    s->frame = malloc(depth * sizeof(int));
+    assert(s->frame);
+    memcpy(s->frame, frame, depth * sizeof(int));
+    nr_folded ++;
+  }
+  s->nr_inst += nr_inst;
+}
+
+static void push_frame(vaddr_t addr) {
+  if (depth == FTRACE_MAX_DEPTH) { nr_lost ++; return; }
+  frame[depth] = elf_symbol_find(addr);
+  frame_hash[depth + 1] = (frame_hash[depth] ^ (uint32_t)frame[depth]) * 1099511628211ull;
+  depth ++;
+}
+
+void ftrace_event(vaddr_t pc, vaddr_t target, bool is_call) {
+  // the function running before the first call is the root
+  if (depth == 0) push_frame(pc);
+  folded_account();
+
+  if (is_call) {
+    push_frame(target);
+    log_write(FMT_WORD ": %*scall [%s@" FMT_WORD "]\n", pc, (depth - 2) * 2, "",
+        elf_symbol_name(frame[depth - 1]), target);
+  } else {
+    log_write(FMT_WORD ": %*sret  [%s]\n", pc, (depth - 2 > 0 ? depth - 2 : 0) * 2, "",
+        elf_symbol_name(frame[depth - 1]));
+    if (nr_lost > 0) nr_lost --;
+    else if (depth > 1) depth --;
+  }
+}
+
+static void ftrace_dump_folded() {
+  folded_account();
+  for (uint64_t i = 0; i < nr_folded_slot; i ++) {
+    FoldedStack *s = &folded[i];
+    if (s->depth == 0) continue;
+    for (int d = 0; d < s->depth; d ++) {
+      fprintf(folded_fp, "%s%s", (d == 0 ? "" : ";"), elf_symbol_name(s->frame[d]));
+    }
+    fprintf(folded_fp, " %" PRIu64 "\n", s->nr_inst);
+  }
+  fclose(folded_fp);
+}
+
+// the guest jumps to another point of execution, e.g. a checkpoint is restored
+void ftrace_reset() {
+  extern uint64_t g_nr_guest_inst;
+  depth = 0;
+  nr_lost = 0;
+  last_inst = g_nr_guest_inst;
+}
+
+// a forked child does not write the folded stacks of the parent
+void ftrace_fork_child() {
+  folded_fp = NULL;
+}
+
+// function calls are only traced when symbols are loaded
+void init_ftrace(const char *elf_file, const char *folded_file) {
+  if (elf_file == NULL) return;
+  ftrace_enable = true;
+  if (folded_file != NULL) {
+    folded_fp = fopen(folded_file, "w");
+    Assert(folded_fp, "Can not open '%s'", folded_file);
+    atexit(ftrace_dump_folded);
+  }
+}
@@ -0,0 +1,60 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+ITraceRecord itrace_ringbuf[CONFIG_ITRACE_RINGBUF_SIZE] = {};
+uint64_t itrace_nr = 0;
+
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+
+static void itrace_format(char *buf, int size, ITraceRecord *r) {
+  char *p = buf;
+  p += snprintf(p, size, FMT_WORD ":", r->pc);
+  int ilen = r->len;
+  int i;
+#ifdef CONFIG_ISA_x86
+  for (i = 0; i < ilen; i ++) {
+#else
+  for (i = ilen - 1; i >= 0; i --) {
+#endif
+    p += snprintf(p, 4, " %02x", r->inst[i]);
+  }
+  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
+  int space_len = ilen_max - ilen;
+  if (space_len < 0) space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+
+  disassemble(p, buf + size - p,
+      MUXDEF(CONFIG_ISA_x86, r->pc + ilen, r->pc), r->inst, ilen);
+}
+
+void itrace_format_last(char *buf, int size) {
+  assert(itrace_nr > 0);
+  itrace_format(buf, size, &itrace_ringbuf[(itrace_nr - 1) % CONFIG_ITRACE_RINGBUF_SIZE]);
+}
+
+// print the recent instructions, the last one is pointed by an arrow
+void itrace_dump() {
+  uint64_t nr = (itrace_nr < CONFIG_ITRACE_RINGBUF_SIZE ? itrace_nr : CONFIG_ITRACE_RINGBUF_SIZE);
+  uint64_t i;
+  for (i = itrace_nr - nr; i < itrace_nr; i ++) {
+    char buf[128];
+    itrace_format(buf, sizeof(buf), &itrace_ringbuf[i % CONFIG_ITRACE_RINGBUF_SIZE]);
+    _Log("%s %s\n", (i == itrace_nr - 1 ? "-->" : "   "), buf);
+  }
+}
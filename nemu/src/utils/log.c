@@ -20,12 +20,147 @@ extern uint64_t g_nr_guest_inst;
 #ifndef CONFIG_TARGET_AM
 FILE *log_fp = NULL;
 
+#ifdef CONFIG_LOG_ASYNC
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* When the log is written to a file, messages are put into a lock-free
+ * single-producer single-consumer ring buffer by the CPU thread, and a
+ * background thread writes them out with large write(2) calls. The writer
+ * sleeps on `log_ready` while the buffer is empty, and the CPU thread only
+ * takes the lock to wake it up. Waiting for room or for the buffer to drain
+ * is done on `log_drained`, which is signaled after each write.
+ */
+#define LOG_BUF_SIZE (4 * 1024 * 1024)
+
+static char log_buf[LOG_BUF_SIZE];
+static _Atomic uint64_t log_head = 0;  // only written by the CPU thread
+static _Atomic uint64_t log_tail = 0;  // only written by the writer thread
+static int log_fd = -1;                // -1 if the log is written synchronously
+static _Atomic bool writer_idle = false;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_drained = PTHREAD_COND_INITIALIZER;
+
+static void* log_writer(void *arg) {
+  while (true) {
+    uint64_t tail = atomic_load_explicit(&log_tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&log_head, memory_order_acquire);
+    if (head == tail) {
+      pthread_mutex_lock(&log_lock);
+      // pairs with the fence in log_wake_writer(), so that either the new head is
+      // seen here, or the CPU thread sees `writer_idle` and signals
+      atomic_store(&writer_idle, true);
+      while (atomic_load(&log_head) == tail) pthread_cond_wait(&log_ready, &log_lock);
+      atomic_store(&writer_idle, false);
+      pthread_mutex_unlock(&log_lock);
+      continue;
+    }
+    uint64_t off = tail % LOG_BUF_SIZE;
+    uint64_t n = head - tail;
+    if (n > LOG_BUF_SIZE - off) n = LOG_BUF_SIZE - off;
+    ssize_t ret = write(log_fd, log_buf + off, n);
+    // drop the data on error, or the CPU thread will wait forever
+    if (ret <= 0) ret = n;
+    atomic_store_explicit(&log_tail, tail + ret, memory_order_release);
+    pthread_mutex_lock(&log_lock);
+    pthread_cond_broadcast(&log_drained);
+    pthread_mutex_unlock(&log_lock);
+  }
+  return NULL;
+}
+
+// block until the writer has consumed everything before `head`
+static void log_wait_tail(uint64_t head) {
+  pthread_mutex_lock(&log_lock);
+  while (atomic_load_explicit(&log_tail, memory_order_acquire) < head) {
+    pthread_cond_wait(&log_drained, &log_lock);
+  }
+  pthread_mutex_unlock(&log_lock);
+}
+
+static void log_wake_writer() {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&writer_idle, memory_order_relaxed)) {
+    pthread_mutex_lock(&log_lock);
+    pthread_cond_signal(&log_ready);
+    pthread_mutex_unlock(&log_lock);
+  }
+}
+
+static void log_push(const char *str, uint64_t len) {
+  while (len > 0) {
+    uint64_t head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    uint64_t room = LOG_BUF_SIZE - (head - atomic_load_explicit(&log_tail, memory_order_acquire));
+    if (room == 0) { log_wait_tail(head - LOG_BUF_SIZE + 1); continue; }
+    uint64_t off = head % LOG_BUF_SIZE;
+    uint64_t n = len;
+    if (n > room) n = room;
+    if (n > LOG_BUF_SIZE - off) n = LOG_BUF_SIZE - off;
+    memcpy(log_buf + off, str, n);
+    atomic_store_explicit(&log_head, head + n, memory_order_release);
+    log_wake_writer();
+    str += n;
+    len -= n;
+  }
+}
+
+void log_printf(const char *fmt, ...) {
+  va_list ap;
+  if (log_fd == -1) {
+    va_start(ap, fmt);
+    vfprintf(log_fp, fmt, ap);
+    va_end(ap);
+    fflush(log_fp);
+    return;
+  }
+
+  char buf[1024];
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len < sizeof(buf)) { log_push(buf, len); return; }
+
+  char *p = malloc(len + 1);
+  assert(p);
+  va_start(ap, fmt);
+  vsnprintf(p, len + 1, fmt, ap);
+  va_end(ap);
+  log_push(p, len);
+  free(p);
+}
+#endif
+
+// make sure everything logged so far is written to the log file
+void log_flush() {
+#ifdef CONFIG_LOG_ASYNC
+  if (log_fd != -1) log_wait_tail(atomic_load_explicit(&log_head, memory_order_relaxed));
+#endif
+  if (log_fp != NULL) fflush(log_fp);
+}
+
+// the log file belongs to the parent, a forked child only logs to stdout
+void log_fork_child() {
+  IFDEF(CONFIG_LOG_ASYNC, log_fd = -1);
+  if (log_fp != stdout) log_fp = NULL;
+}
+
 void init_log(const char *log_file) {
   log_fp = stdout;
   if (log_file != NULL) {
     FILE *fp = fopen(log_file, "w");
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
+#ifdef CONFIG_LOG_ASYNC
+    log_fd = fileno(fp);
+    pthread_t writer;
+    int ret = pthread_create(&writer, NULL, log_writer, NULL);
+    Assert(ret == 0, "Can not create the log writer thread");
+    pthread_detach(writer);
+    atexit(log_flush);
+#endif
   }
   Log("Log is written to %s", log_file ? log_file : "stdout");
 }
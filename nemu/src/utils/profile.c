@@ -0,0 +1,224 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <sys/mman.h>
+
+/* Guest execution counts are kept in an array indexed by the pc in pmem.
+ * It is allocated with mmap() so that only the pages touched by the guest
+ * take memory. In exact mode every instruction is counted, and basic
+ * blocks are entries of control flow to a non-sequential pc. In sampling
+ * mode the pc is sampled every CONFIG_PROFILE_SAMPLE_INTERVAL instructions
+ * with the weight of the instructions executed since the last sample.
+ */
+uint64_t *profile_count = NULL;
+#ifdef CONFIG_PROFILE_EXACT
+vaddr_t profile_next_pc = 0;
+#else
+uint64_t profile_deadline = 0;
+#endif
+
+typedef struct {
+  vaddr_t pc;
+  uint64_t nr_entry;
+  uint64_t nr_inst;
+} ProfileBlock;
+
+static vaddr_t *touched = NULL;  // pcs with non-zero counts
+static uint64_t nr_touched = 0, max_touched = 0;
+static uint64_t nr_outside = 0;  // instructions executed outside pmem
+
+static FILE *folded_fp = NULL;
+
+extern uint64_t g_nr_guest_inst;
+
+static void count(vaddr_t pc, uint64_t weight) {
+  uint64_t idx = (uint64_t)(pc - CONFIG_MBASE) >> PROFILE_SHIFT;
+  if (idx >= PROFILE_NR_SLOT) { nr_outside += weight; return; }
+  if (profile_count[idx] == 0) {
+    if (nr_touched == max_touched) {
+      max_touched = (max_touched ? max_touched * 2 : 4096);
+      touched = realloc(touched, max_touched * sizeof(vaddr_t));
+      assert(touched);
+    }
+    touched[nr_touched ++] = pc;
+  }
+  profile_count[idx] += weight;
+}
+
+#ifdef CONFIG_PROFILE_EXACT
+static ProfileBlock *block = NULL;
+static uint64_t nr_block_slot = 0, nr_block = 0;
+static vaddr_t block_pc = 0;
+static uint64_t block_start = 0;
+
+static ProfileBlock* block_find(ProfileBlock *tab, uint64_t nr_slot, vaddr_t pc) {
+  uint64_t i = ((uint64_t)pc * 0x9e3779b97f4a7c15ull) >> 40;
+  for (i &= nr_slot - 1; tab[i].nr_entry != 0 && tab[i].pc != pc; i = (i + 1) & (nr_slot - 1)) ;
+  return &tab[i];
+}
+
+static ProfileBlock* block_get(vaddr_t pc) {
+  if (nr_block * 2 >= nr_block_slot) {
+    uint64_t nr_slot = (nr_block_slot ? nr_block_slot * 2 : 4096);
+    ProfileBlock *tab = calloc(nr_slot, sizeof(ProfileBlock));
+    assert(tab);
+    for (uint64_t i = 0; i < nr_block_slot; i ++) {
+      if (block[i].nr_entry != 0) *block_find(tab, nr_slot, block[i].pc) = block[i];
+    }
+    free(block);
+    block = tab;
+    nr_block_slot = nr_slot;
+  }
+  ProfileBlock *b = block_find(block, nr_block_slot, pc);
+  if (b->nr_entry == 0) { b->pc = pc; nr_block ++; }
+  return b;
+}
+
+// exact mode: the instruction at `pc` is executed for the first time,
+// is outside pmem, or starts a basic block
+void profile_slow(vaddr_t pc) {
+  if (pc != profile_next_pc) {
+    if (nr_block != 0) block_get(block_pc)->nr_inst += g_nr_guest_inst - block_start;
+    block_get(pc)->nr_entry ++;
+    block_pc = pc;
+    block_start = g_nr_guest_inst;
+  }
+  count(pc, 1);
+}
+#else
+static uint64_t last_sample = 0;
+static uint32_t seed = 1;
+
+void profile_sample(vaddr_t pc) {
+  count(pc, g_nr_guest_inst - last_sample);
+  last_sample = g_nr_guest_inst;
+  // randomize the interval around its mean to avoid aliasing with loops
+  seed = seed * 1103515245 + 12345;
+  profile_deadline = g_nr_guest_inst + CONFIG_PROFILE_SAMPLE_INTERVAL / 2 +
+    (seed >> 8) % CONFIG_PROFILE_SAMPLE_INTERVAL;
+}
+#endif
+
+static inline uint64_t pc_count(vaddr_t pc) {
+  return profile_count[(uint64_t)(pc - CONFIG_MBASE) >> PROFILE_SHIFT];
+}
+
+typedef struct {
+  int sym;
+  vaddr_t pc;
+  uint64_t n;
+} ProfileItem;
+
+static int item_cmp_sym(const void *a, const void *b) {
+  const ProfileItem *x = a, *y = b;
+  return (x->sym > y->sym) - (x->sym < y->sym);
+}
+
+static int item_cmp_n(const void *a, const void *b) {
+  const ProfileItem *x = a, *y = b;
+  return (x->n < y->n) - (x->n > y->n);
+}
+
+static void report_items(const char *title, ProfileItem *item, int nr, uint64_t total, bool show_pc) {
+  qsort(item, nr, sizeof(ProfileItem), item_cmp_n);
+  Log("profile: hottest %s", title);
+  for (int i = 0; i < nr && i < PROFILE_NR_REPORT; i ++) {
+    if (show_pc && item[i].sym >= 0) {
+      _Log("  %6.2f%% %12" PRIu64 "  " FMT_WORD " <%s+0x%x>\n", 100.0 * item[i].n / total, item[i].n,
+          item[i].pc, elf_symbol_name(item[i].sym), (uint32_t)(item[i].pc - elf_symbol_addr(item[i].sym)));
+    } else if (show_pc) {
+      _Log("  %6.2f%% %12" PRIu64 "  " FMT_WORD "\n", 100.0 * item[i].n / total, item[i].n, item[i].pc);
+    } else {
+      _Log("  %6.2f%% %12" PRIu64 "  %s\n", 100.0 * item[i].n / total, item[i].n, elf_symbol_name(item[i].sym));
+    }
+  }
+}
+
+void profile_report() {
+  uint64_t total = nr_outside;
+  ProfileItem *item = malloc((nr_touched + 1) * sizeof(ProfileItem));
+  assert(item);
+  for (uint64_t i = 0; i < nr_touched; i ++) {
+    item[i] = (ProfileItem) { .sym = elf_symbol_find(touched[i]), .pc = touched[i], .n = pc_count(touched[i]) };
+    total += item[i].n;
+  }
+  if (total == 0) { free(item); return; }
+
+  if (folded_fp != NULL) {
+    for (uint64_t i = 0; i < nr_touched; i ++) {
+      fprintf(folded_fp, "%s;" FMT_WORD " %" PRIu64 "\n", elf_symbol_name(item[i].sym), item[i].pc, item[i].n);
+    }
+    fflush(folded_fp);
+  }
+
+  // merge the counts of the same function
+  qsort(item, nr_touched, sizeof(ProfileItem), item_cmp_sym);
+  int nr_func = 0;
+  for (uint64_t i = 0; i < nr_touched; i ++) {
+    if (nr_func > 0 && item[nr_func - 1].sym == item[i].sym) item[nr_func - 1].n += item[i].n;
+    else item[nr_func ++] = item[i];
+  }
+  report_items("functions", item, nr_func, total, false);
+
+#ifdef CONFIG_PROFILE_EXACT
+  if (nr_block != 0) block_get(block_pc)->nr_inst += g_nr_guest_inst - block_start;
+  block_start = g_nr_guest_inst;
+  item = realloc(item, (nr_block + 1) * sizeof(ProfileItem));
+  assert(item);
+  int nr = 0;
+  for (uint64_t i = 0; i < nr_block_slot; i ++) {
+    if (block[i].nr_entry == 0) continue;
+    item[nr ++] = (ProfileItem) { .sym = elf_symbol_find(block[i].pc), .pc = block[i].pc, .n = block[i].nr_inst };
+  }
+  report_items("basic blocks (instructions executed)", item, nr, total, true);
+#else
+  for (uint64_t i = 0; i < nr_touched; i ++) {
+    item[i] = (ProfileItem) { .sym = elf_symbol_find(touched[i]), .pc = touched[i], .n = pc_count(touched[i]) };
+  }
+  report_items("pcs (sampled instructions)", item, nr_touched, total, true);
+#endif
+  if (nr_outside != 0) Log("profile: %" PRIu64 " instructions outside pmem", nr_outside);
+  free(item);
+}
+
+// the guest jumps to another point of execution, e.g. a checkpoint is restored
+void profile_reset() {
+#ifdef CONFIG_PROFILE_EXACT
+  // the next instruction starts a new block
+  profile_next_pc = (vaddr_t)-1;
+  block_start = g_nr_guest_inst;
+#else
+  last_sample = g_nr_guest_inst;
+  profile_deadline = g_nr_guest_inst + CONFIG_PROFILE_SAMPLE_INTERVAL;
+#endif
+}
+
+// a forked child does not write the folded profile of the parent
+void profile_fork_child() {
+  folded_fp = NULL;
+}
+
+void init_profile(const char *folded_file) {
+  profile_count = mmap(NULL, PROFILE_NR_SLOT * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(profile_count != MAP_FAILED, "Can not allocate the profile counters");
+  IFDEF(CONFIG_PROFILE_EXACT, profile_next_pc = (vaddr_t)-1);
+  IFDEF(CONFIG_PROFILE_SAMPLE, profile_deadline = CONFIG_PROFILE_SAMPLE_INTERVAL);
+  if (folded_file != NULL) {
+    folded_fp = fopen(folded_file, "w");
+    Assert(folded_fp, "Can not open '%s'", folded_file);
+  }
+}
@@ -44,6 +44,23 @@ uint64_t get_time() {
   return now - boot_time;
 }
 
+#ifdef CONFIG_ICOUNT
+// instructions not executed but counted as time passing by, see alarm_skip()
+uint64_t g_nr_skip_inst = 0;
+#endif
+
+uint64_t get_guest_time() {
+#ifdef CONFIG_ICOUNT
+  extern uint64_t g_nr_guest_inst;
+  uint64_t n = g_nr_guest_inst + g_nr_skip_inst;
+  // split to avoid overflow in `n * 1000000`
+  return n / CONFIG_ICOUNT_FREQ * 1000000 + n % CONFIG_ICOUNT_FREQ * 1000000 / CONFIG_ICOUNT_FREQ;
+#else
+  return get_time();
+#endif
+}
+
 void init_rand() {
-  srand(get_time_internal());
+  // a fixed seed keeps the randomly initialized memory reproducible in icount mode
+  srand(MUXDEF(CONFIG_ICOUNT, 0, get_time_internal()));
 }
@@ -0,0 +1,87 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+// decode the memory trace written by src/memory/mtrace.c
+#define MTRACE_VERSION 1
+
+static FILE *fp = NULL;
+
+static bool get_varint(uint64_t *v) {
+  uint64_t ret = 0;
+  int shift = 0;
+  int c;
+  do {
+    c = fgetc(fp);
+    if (c == EOF || shift >= 64) return false;
+    ret |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  *v = ret;
+  return true;
+}
+
+static bool get_zigzag(uint64_t *delta) {
+  uint64_t v;
+  if (!get_varint(&v)) return false;
+  *delta = (v >> 1) ^ -(v & 1);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    printf("Usage: %s MTRACE_FILE\n", argv[0]);
+    printf("Each line is: instruction count, pc, R/W, address, length, data\n");
+    return 1;
+  }
+  fp = fopen(argv[1], "rb");
+  if (fp == NULL) { perror(argv[1]); return 1; }
+
+  char header[8];
+  if (fread(header, sizeof(header), 1, fp) != 1 || memcmp(header, "NEMUMTR", 7) != 0) {
+    fprintf(stderr, "%s is not a memory trace\n", argv[1]);
+    return 1;
+  }
+  if (header[7] != MTRACE_VERSION) {
+    fprintf(stderr, "unsupported version %d, expected %d\n", header[7], MTRACE_VERSION);
+    return 1;
+  }
+
+  uint64_t inst = 0, pc = 0, addr = 0, nr_record = 0;
+  int tag;
+  while ((tag = fgetc(fp)) != EOF) {
+    uint64_t delta, data;
+    bool ok = get_varint(&delta);
+    inst += delta;
+    if (ok && !(tag & 0x8)) { ok = get_zigzag(&delta); pc += delta; }
+    if (ok) { ok = get_zigzag(&delta); addr += delta; }
+    if (ok) ok = get_varint(&data);
+    if (!ok) {
+      fprintf(stderr, "truncated record #%" PRIu64 "\n", nr_record);
+      return 1;
+    }
+    printf("%" PRIu64 " 0x%08" PRIx64 ": %c 0x%08" PRIx64 " %d 0x%" PRIx64 "\n",
+        inst, pc, (tag & 1) ? 'W' : 'R', addr, 1 << ((tag >> 1) & 3), data);
+    nr_record ++;
+  }
+
+  fclose(fp);
+  return 0;
+}